@@ -0,0 +1,316 @@
+/*
+ * desafio1_serie.h - Serie temporal comprimida por sensor (estilo Gorilla)
+ *
+ * Cada amostra tem um instante (ms) e SERIE_VALUES valores. As amostras
+ * sao gravadas em blocos de bits de tamanho fixo:
+ *
+ *   instante: delta-do-delta em relacao a amostra anterior, em faixas de
+ *             1, 9, 12, 16 ou 36 bits (intervalo regular custa 1 bit);
+ *   valor:    XOR com o valor anterior: '0' se igual; '10' + bits
+ *             significativos se couberem na janela anterior; '11' + 5 bits
+ *             de zeros a esquerda + 6 de comprimento + bits significativos.
+ *
+ * Os valores chegam com duas casas decimais. Eles sao gravados como
+ * double do numero inteiro de centesimos: assim a mantissa termina em
+ * zeros e o XOR de leituras proximas fica com poucos bits significativos.
+ * Cada amostra e decodificada de volta com precisao de 0,01.
+ *
+ * A leitura e um iterador que decodifica bloco a bloco, sem copiar. Os
+ * blocos guardam o primeiro e o ultimo instante, e a consulta por
+ * intervalo pula os blocos de fora dele.
+ */
+
+#ifndef DESAFIO1_SERIE_H
+#define DESAFIO1_SERIE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERIE_VALUES      2       // temperatura, umidade
+#define SERIE_SCALE       100.0   // duas casas decimais
+#define SERIE_BLOCK_WORDS 64      // 512 bytes de bits por bloco
+#define SERIE_MAX_SAMPLE  (4 + 32 + SERIE_VALUES * (2 + 5 + 6 + 64))   // pior caso em bits
+
+typedef struct serie_block {
+    struct serie_block *next;
+    int64_t t_first, t_last;    // ms
+    uint32_t count;             // amostras
+    uint32_t nbits;             // bits usados
+    uint64_t bits[SERIE_BLOCK_WORDS];
+} serie_block_t;
+
+// Estado do codificador/decodificador ao longo de um bloco
+typedef struct {
+    int64_t t, delta;
+    uint64_t v[SERIE_VALUES];   // bits do double anterior
+    int lead[SERIE_VALUES];     // janela do ultimo XOR; -1 = nenhuma
+    int trail[SERIE_VALUES];
+} serie_state_t;
+
+typedef struct {
+    serie_block_t *head, *tail;     // mais antigo ... bloco aberto
+    size_t blocks;
+    uint64_t samples;
+    serie_state_t enc;
+} serie_t;
+
+/* ------------------------------- bits ------------------------------- */
+
+// Acrescenta os n bits baixos de v (n <= 64), do mais significativo ao menos.
+static inline void serie_put(serie_block_t *b, uint64_t v, int n) {
+    if (n == 0) return;
+    if (n < 64) v &= (1ull << n) - 1;
+    uint32_t w = b->nbits >> 6;
+    int room = 64 - (int)(b->nbits & 63);
+    if (n <= room) {
+        b->bits[w] |= v << (room - n);
+    } else {
+        b->bits[w] |= v >> (n - room);
+        b->bits[w + 1] |= v << (64 - (n - room));
+    }
+    b->nbits += (uint32_t)n;
+}
+
+static inline uint64_t serie_get(const serie_block_t *b, uint32_t *pos, int n) {
+    if (n == 0) return 0;
+    uint32_t w = *pos >> 6;
+    int room = 64 - (int)(*pos & 63);
+    uint64_t v;
+    if (n <= room) v = b->bits[w] >> (room - n);
+    else v = b->bits[w] << (n - room) | b->bits[w + 1] >> (64 - (n - room));
+    if (n < 64) v &= (1ull << n) - 1;
+    *pos += (uint32_t)n;
+    return v;
+}
+
+// Inteiro com sinal em n bits (faixa assimetrica: -(2^(n-1)-1) .. 2^(n-1))
+static inline int64_t serie_get_signed(const serie_block_t *b, uint32_t *pos, int n) {
+    int64_t v = (int64_t)serie_get(b, pos, n);
+    return v > (1ll << (n - 1)) ? v - (1ll << n) : v;
+}
+
+static inline uint64_t serie_quant(double x) {
+    double q = (double)(int64_t)(x * SERIE_SCALE + (x >= 0 ? 0.5 : -0.5));
+    uint64_t u;
+    memcpy(&u, &q, sizeof(u));
+    return u;
+}
+
+static inline double serie_dequant(uint64_t u) {
+    double q;
+    memcpy(&q, &u, sizeof(q));
+    return q / SERIE_SCALE;
+}
+
+/* --------------------------- codificacao --------------------------- */
+
+static inline void serie_init(serie_t *s) {
+    memset(s, 0, sizeof(*s));
+}
+
+static inline void serie_put_value(serie_block_t *b, serie_state_t *st, int i, uint64_t x) {
+    uint64_t d = x ^ st->v[i];
+    st->v[i] = x;
+    if (!d) { serie_put(b, 0, 1); return; }
+    int lead = __builtin_clzll(d), trail = __builtin_ctzll(d);
+    if (lead > 31) lead = 31;
+    if (st->lead[i] >= 0 && lead >= st->lead[i] && trail >= st->trail[i]) {
+        serie_put(b, 2, 2);
+        serie_put(b, d >> st->trail[i], 64 - st->lead[i] - st->trail[i]);
+        return;
+    }
+    int len = 64 - lead - trail;
+    serie_put(b, 3, 2);
+    serie_put(b, (uint64_t)lead, 5);
+    serie_put(b, (uint64_t)(len & 63), 6);      // 64 gravado como 0
+    serie_put(b, d >> trail, len);
+    st->lead[i] = lead;
+    st->trail[i] = trail;
+}
+
+/*
+ * Acrescenta uma amostra. Instantes devem ser crescentes; um instante
+ * menor que o anterior e gravado como o anterior. Retorna -1 se faltar
+ * memoria.
+ */
+static inline int serie_append(serie_t *s, int64_t t, const double *vals) {
+    serie_block_t *b = s->tail;
+    serie_state_t *st = &s->enc;
+    if (b && t < st->t) t = st->t;
+
+    int64_t delta = b ? t - st->t : 0;
+    int64_t dod = delta - st->delta;
+    int fits = dod > -(1ll << 31) && dod <= (1ll << 31);
+    if (!b || !fits || b->nbits + SERIE_MAX_SAMPLE > SERIE_BLOCK_WORDS * 64) {
+        serie_block_t *nb = (serie_block_t *)calloc(1, sizeof(serie_block_t));
+        if (!nb) return -1;
+        if (b) b->next = nb; else s->head = nb;
+        s->tail = b = nb;
+        s->blocks++;
+        b->t_first = t;
+        // primeira amostra do bloco: valores crus
+        st->t = t;
+        st->delta = 0;
+        for (int i = 0; i < SERIE_VALUES; i++) {
+            st->v[i] = serie_quant(vals[i]);
+            st->lead[i] = -1;
+            serie_put(b, st->v[i], 64);
+        }
+    } else {
+        if (dod == 0) {
+            serie_put(b, 0, 1);
+        } else if (dod >= -63 && dod <= 64) {
+            serie_put(b, 2, 2);
+            serie_put(b, (uint64_t)dod, 7);
+        } else if (dod >= -255 && dod <= 256) {
+            serie_put(b, 6, 3);
+            serie_put(b, (uint64_t)dod, 9);
+        } else if (dod >= -2047 && dod <= 2048) {
+            serie_put(b, 14, 4);
+            serie_put(b, (uint64_t)dod, 12);
+        } else {
+            serie_put(b, 15, 4);
+            serie_put(b, (uint64_t)dod, 32);
+        }
+        st->t = t;
+        st->delta = delta;
+        for (int i = 0; i < SERIE_VALUES; i++) serie_put_value(b, st, i, serie_quant(vals[i]));
+    }
+    b->t_last = t;
+    b->count++;
+    s->samples++;
+    return 0;
+}
+
+// Descarta os blocos fechados cujo ultimo instante e anterior a cutoff.
+static inline void serie_trim(serie_t *s, int64_t cutoff) {
+    while (s->head && s->head != s->tail && s->head->t_last < cutoff) {
+        serie_block_t *b = s->head;
+        s->head = b->next;
+        s->blocks--;
+        s->samples -= b->count;
+        free(b);
+    }
+}
+
+static inline size_t serie_bytes(const serie_t *s) {
+    return sizeof(serie_t) + s->blocks * sizeof(serie_block_t);
+}
+
+static inline void serie_free(serie_t *s) {
+    while (s->head) {
+        serie_block_t *b = s->head;
+        s->head = b->next;
+        free(b);
+    }
+    serie_init(s);
+}
+
+/* -------------------------- decodificacao -------------------------- */
+
+typedef struct {
+    const serie_block_t *b;
+    uint32_t pos, idx;          // posicao em bits e amostra dentro do bloco
+    serie_state_t st;
+    int64_t from, to;
+} serie_iter_t;
+
+// Percorre as amostras com from <= t <= to.
+static inline void serie_iter_init(serie_iter_t *it, const serie_t *s, int64_t from, int64_t to) {
+    memset(it, 0, sizeof(*it));
+    it->b = s->head;
+    while (it->b && it->b->t_last < from) it->b = it->b->next;
+    it->from = from;
+    it->to = to;
+}
+
+static inline uint64_t serie_get_value(const serie_block_t *b, uint32_t *pos, serie_state_t *st, int i) {
+    if (!serie_get(b, pos, 1)) return st->v[i];
+    if (serie_get(b, pos, 1)) {
+        st->lead[i] = (int)serie_get(b, pos, 5);
+        int len = (int)serie_get(b, pos, 6);
+        if (len == 0) len = 64;
+        st->trail[i] = 64 - st->lead[i] - len;
+    }
+    int len = 64 - st->lead[i] - st->trail[i];
+    st->v[i] ^= serie_get(b, pos, len) << st->trail[i];
+    return st->v[i];
+}
+
+// Proxima amostra do intervalo; retorna 0 no fim.
+static inline int serie_iter_next(serie_iter_t *it, int64_t *t, double *vals) {
+    while (it->b) {
+        const serie_block_t *b = it->b;
+        if (it->idx == b->count) {
+            it->b = b->next;
+            it->pos = it->idx = 0;
+            if (it->b && it->b->t_first > it->to) it->b = NULL;
+            continue;
+        }
+        serie_state_t *st = &it->st;
+        if (it->idx == 0) {
+            st->t = b->t_first;
+            st->delta = 0;
+            for (int i = 0; i < SERIE_VALUES; i++) st->v[i] = serie_get(b, &it->pos, 64);
+        } else {
+            int64_t dod;
+            if (!serie_get(b, &it->pos, 1)) dod = 0;
+            else if (!serie_get(b, &it->pos, 1)) dod = serie_get_signed(b, &it->pos, 7);
+            else if (!serie_get(b, &it->pos, 1)) dod = serie_get_signed(b, &it->pos, 9);
+            else if (!serie_get(b, &it->pos, 1)) dod = serie_get_signed(b, &it->pos, 12);
+            else dod = serie_get_signed(b, &it->pos, 32);
+            st->delta += dod;
+            st->t += st->delta;
+            for (int i = 0; i < SERIE_VALUES; i++) serie_get_value(b, &it->pos, st, i);
+        }
+        it->idx++;
+        if (st->t < it->from) continue;
+        if (st->t > it->to) { it->b = NULL; break; }
+        *t = st->t;
+        for (int i = 0; i < SERIE_VALUES; i++) vals[i] = serie_dequant(st->v[i]);
+        return 1;
+    }
+    return 0;
+}
+
+/* ------------------------- reamostragem ------------------------- */
+
+typedef struct {
+    int64_t start;              // inicio do intervalo (ms)
+    uint32_t n;                 // amostras no intervalo
+    double min[SERIE_VALUES], max[SERIE_VALUES], sum[SERIE_VALUES];
+} serie_bucket_t;
+
+typedef void (*serie_emit_t)(void *ctx, const serie_bucket_t *bk);
+
+/*
+ * Agrupa as amostras de [from, to] em intervalos de step ms e entrega
+ * minimo, maximo e soma de cada intervalo nao vazio, em ordem.
+ */
+static inline void serie_downsample(const serie_t *s, int64_t from, int64_t to, int64_t step,
+                                    serie_emit_t emit, void *ctx) {
+    serie_iter_t it;
+    serie_iter_init(&it, s, from, to);
+    serie_bucket_t bk = { .n = 0 };
+    int64_t t;
+    double v[SERIE_VALUES];
+    while (serie_iter_next(&it, &t, v)) {
+        int64_t start = from + (t - from) / step * step;
+        if (bk.n && start != bk.start) { emit(ctx, &bk); bk.n = 0; }
+        if (!bk.n) {
+            bk.start = start;
+            for (int i = 0; i < SERIE_VALUES; i++) bk.min[i] = bk.max[i] = bk.sum[i] = v[i];
+        } else {
+            for (int i = 0; i < SERIE_VALUES; i++) {
+                if (v[i] < bk.min[i]) bk.min[i] = v[i];
+                if (v[i] > bk.max[i]) bk.max[i] = v[i];
+                bk.sum[i] += v[i];
+            }
+        }
+        bk.n++;
+    }
+    if (bk.n) emit(ctx, &bk);
+}
+
+#endif
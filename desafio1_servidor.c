@@ -5,8 +5,20 @@
  *
  * Funcao:     Enviar e receber mensagens compostas de caracteres
  * Plataforma: Linux (Unix), ou Windows com CygWin
- * Compilar:   gcc -Wall servidorMonoUDP.c -o servidorMonoUDP
- * Uso:        ./servidorMonoUDP
+ * Compilar:   gcc -Wall servidorMonoUDP.c -o servidorMonoUDP -lpthread
+ * Uso:        ./servidorMonoUDP [-m socket_metricas] [-r retencao_horas]
+ *
+ * Guarda o historico de cada sensor (endereco:porta de origem) numa
+ * serie comprimida em memoria (desafio1_serie.h). Um datagrama
+ * "?segundos|passo" devolve ao remetente o historico recente de cada
+ * sensor, reamostrado em intervalos de passo segundos (min/media/max).
+ * A cada SWEEP_SEC todas as series sao podadas pela retencao, e o sensor
+ * sem amostras dentro dela sai da tabela.
+ * So e atendida a consulta vinda de 127.0.0.0/8: o kernel descarta
+ * origem de loopback chegando de fora, entao ela nao serve para
+ * amplificar trafego contra um endereco forjado. A resposta tem no maximo
+ * QUERY_MAX_BUCKETS intervalos somando todos os sensores; se o pedido
+ * passar disso, o passo e alargado.
  *
  * Autor:      Jose Martins Junior
  *
@@ -15,22 +27,175 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "metricas.h"
+#include "desafio1_serie.h"
 
 #define SIZE 300            //Tamanho maximo do buffer de caracteres
 #define SERVER_PORT 4567    //Porta do servidor
 #define true 1
+#define MAX_SENSORS 64
+#define DEFAULT_RETENTION_H 24
+#define QUERY_MAX_BUCKETS 240   // intervalos por resposta, somando os sensores
+#define SWEEP_SEC 10            // intervalo da poda de todas as series
+
+// Metricas (mesma ordem de MET_DEFS)
+enum {
+    M_PACOTES, M_BYTES, M_INVALIDAS, M_DESCARTES, M_ERROS_RECV, M_AMOSTRAS, M_SERIE_BYTES,
+    M_RECUSADAS, M_SENSORES, M_CONSULTAS_RECUSADAS, M_COUNT
+};
+
+static const met_def_t MET_DEFS[] = {
+    { .name = "sensores_pacotes_recebidos_total", .help = "Datagramas recebidos", .type = MET_COUNTER },
+    { .name = "sensores_bytes_recebidos_total", .help = "Bytes recebidos", .type = MET_COUNTER },
+    { .name = "sensores_mensagens_invalidas_total", .help = "Mensagens fora do formato T|U", .type = MET_COUNTER },
+    { .name = "sensores_descartes_kernel_total", .help = "Datagramas descartados pelo kernel (fila do socket cheia)",
+      .type = MET_COUNTER },
+    { .name = "sensores_erros_recv_total", .help = "Falhas de recvmsg", .type = MET_COUNTER },
+    { .name = "sensores_amostras_retidas", .help = "Amostras guardadas no historico", .type = MET_GAUGE },
+    { .name = "sensores_serie_bytes", .help = "Memoria ocupada pelo historico", .type = MET_GAUGE },
+    { .name = "sensores_amostras_recusadas_total", .help = "Amostras validas nao guardadas (tabela de sensores cheia "
+      "ou sem memoria)", .type = MET_COUNTER },
+    { .name = "sensores_ativos", .help = "Sensores com historico na tabela", .type = MET_GAUGE },
+    { .name = "sensores_consultas_recusadas_total", .help = "Consultas de historico vindas de fora do loopback",
+      .type = MET_COUNTER },
+};
+
+// Historico por sensor, identificado pelo endereco de origem
+typedef struct {
+    struct sockaddr_in addr;
+    serie_t serie;
+} sensor_t;
+
+static sensor_t sensors[MAX_SENSORS];
+static int sensorCount = 0;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static sensor_t *find_sensor(const struct sockaddr_in *a) {
+    for (int i = 0; i < sensorCount; i++) {
+        if (sensors[i].addr.sin_addr.s_addr == a->sin_addr.s_addr &&
+            sensors[i].addr.sin_port == a->sin_port)
+            return &sensors[i];
+    }
+    if (sensorCount == MAX_SENSORS) return NULL;
+    sensor_t *s = &sensors[sensorCount++];
+    s->addr = *a;
+    serie_init(&s->serie);
+    met_add(M_SENSORES, 1);
+    return s;
+}
+
+/*
+ * Poda todas as series pela retencao, inclusive de sensores que pararam
+ * de enviar. O sensor cuja ultima amostra ja saiu da retencao e liberado;
+ * o ultimo da tabela ocupa o lugar dele.
+ */
+static void sweep_sensors(int64_t cutoff) {
+    for (int i = 0; i < sensorCount; ) {
+        serie_t *sr = &sensors[i].serie;
+        size_t before = serie_bytes(sr);
+        uint64_t samples = sr->samples;
+        int expired = !sr->tail || sr->tail->t_last < cutoff;
+        if (expired) serie_free(sr);
+        else serie_trim(sr, cutoff);
+        met_add(M_AMOSTRAS, -(int64_t)(samples - sr->samples));
+        met_add(M_SERIE_BYTES, (int64_t)serie_bytes(sr) - (int64_t)before);
+        if (!expired) { i++; continue; }
+        met_add(M_SENSORES, -1);
+        sensors[i] = sensors[--sensorCount];
+    }
+}
+
+// Resposta de consulta: linhas acumuladas e enviadas em datagramas de ate SIZE bytes
+typedef struct {
+    int sockId;
+    const struct sockaddr_in *to;
+    char out[SIZE];
+    int len;
+} reply_t;
+
+static void reply_flush(reply_t *r) {
+    if (!r->len) return;
+    sendto(r->sockId, r->out, r->len, 0, (const struct sockaddr *)r->to, sizeof(*r->to));
+    r->len = 0;
+}
+
+static void reply_line(reply_t *r, const char *line, int n) {
+    if (r->len + n > SIZE) reply_flush(r);
+    memcpy(r->out + r->len, line, n);
+    r->len += n;
+}
+
+static void emit_bucket(void *ctx, const serie_bucket_t *bk) {
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%lld n=%u T=%.2f/%.2f/%.2f U=%.2f/%.2f/%.2f\n",
+                     (long long)(bk->start / 1000), bk->n,
+                     bk->min[0], bk->sum[0] / bk->n, bk->max[0],
+                     bk->min[1], bk->sum[1] / bk->n, bk->max[1]);
+    reply_line((reply_t *)ctx, line, n);
+}
+
+// "?segundos|passo": historico recente de todos os sensores
+static void answer_query(int sockId, const struct sockaddr_in *from, const char *q) {
+    long secs = 3600, step = 60;
+    sscanf(q, "%ld|%ld", &secs, &step);
+    if (secs <= 0) secs = 3600;
+    if (secs > 366L * 24 * 3600) secs = 366L * 24 * 3600;  // alem da maior retencao util
+    if (step <= 0) step = 60;
+    // resposta limitada: a origem pode ser forjada e o laco de recepcao para enquanto responde
+    long per_sensor = sensorCount ? QUERY_MAX_BUCKETS / sensorCount : QUERY_MAX_BUCKETS;
+    if (per_sensor < 1) per_sensor = 1;
+    if (secs / step >= per_sensor) step = secs / per_sensor + 1;
+    int64_t to = now_ms(), since = to - (int64_t)secs * 1000;
+
+    reply_t r = { .sockId = sockId, .to = from, .len = 0 };
+    for (int i = 0; i < sensorCount; i++) {
+        sensor_t *s = &sensors[i];
+        char line[128];
+        size_t bytes = serie_bytes(&s->serie);
+        int n = snprintf(line, sizeof(line), "sensor %s:%d amostras=%llu bytes=%zu (%.2f por amostra) passo=%ld\n",
+                         inet_ntoa(s->addr.sin_addr), ntohs(s->addr.sin_port),
+                         (unsigned long long)s->serie.samples, bytes,
+                         s->serie.samples ? (double)bytes / (double)s->serie.samples : 0.0, step);
+        reply_line(&r, line, n);
+        serie_downsample(&s->serie, since, to, (int64_t)step * 1000, emit_bucket, &r);
+    }
+    reply_flush(&r);
+}
 
 int main(int argc, char *argv[]) {
     int sockId, recvBytes;
     struct sockaddr_in server;
     char buf[SIZE];
+    const char *metrics_path = NULL;
+    int retention_h = DEFAULT_RETENTION_H;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:")) != -1) {
+        if (opt == 'm') metrics_path = optarg;
+        else if (opt == 'r') retention_h = atoi(optarg);
+        else { printf("Uso: %s [-m socket_metricas] [-r retencao_horas]\n", argv[0]); return(1); }
+    }
+    if (retention_h <= 0) retention_h = DEFAULT_RETENTION_H;
+    int64_t retention_ms = (int64_t)retention_h * 3600 * 1000;
+    met_init(MET_DEFS, sizeof(MET_DEFS) / sizeof(MET_DEFS[0]));
+    if (metrics_path && met_serve(metrics_path) < 0) return(1);
 
     if ((sockId = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
        printf("Datagram socket nao pode ser aberto\n");
@@ -40,6 +205,12 @@ int main(int argc, char *argv[]) {
     // Permite reuso rápido da porta ao reiniciar o servidor
     int yes = 1;
     setsockopt(sockId, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    // O kernel informa em cada datagrama quantos ja descartou por fila cheia
+    setsockopt(sockId, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(yes));
+    // Sem datagramas, recvmsg volta a cada SWEEP_SEC para a poda
+    struct timeval rcv_to = { SWEEP_SEC, 0 };
+    setsockopt(sockId, SOL_SOCKET, SO_RCVTIMEO, &rcv_to, sizeof(rcv_to));
+    int64_t last_sweep = now_ms();
 
     memset(&server, 0, sizeof(server));
     server.sin_family = AF_INET;
@@ -58,9 +229,37 @@ int main(int argc, char *argv[]) {
         memset(&from, 0, sizeof(from));
         memset(buf, 0, sizeof(buf));
 
-        recvBytes = recvfrom(sockId, buf, SIZE - 1, 0, (struct sockaddr *)&from, &fromLen);
+        struct iovec iov = { buf, SIZE - 1 };
+        char ctrl[CMSG_SPACE(sizeof(uint32_t))];
+        struct msghdr msg = {
+            .msg_name = &from, .msg_namelen = fromLen,
+            .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = ctrl, .msg_controllen = sizeof(ctrl),
+        };
+        recvBytes = recvmsg(sockId, &msg, 0);
+        int64_t now = now_ms();
+        if (now - last_sweep >= SWEEP_SEC * 1000) {
+            sweep_sensors(now - retention_ms);
+            last_sweep = now;
+        }
+        if (recvBytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) met_add(M_ERROS_RECV, 1);
         if (recvBytes <= 0) continue;
         buf[recvBytes] = '\0'; // garante string terminada
+        met_add(M_PACOTES, 1);
+        met_add(M_BYTES, recvBytes);
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+                met_set(M_DESCARTES, drops);
+            }
+        }
+
+        if (buf[0] == '?') {
+            if ((ntohl(from.sin_addr.s_addr) >> 24) == 127) answer_query(sockId, &from, buf + 1);
+            else met_add(M_CONSULTAS_RECUSADAS, 1);
+            continue;
+        }
 
         // Parse "T|U"
         char *sep = strchr(buf, '|');
@@ -69,8 +268,25 @@ int main(int argc, char *argv[]) {
             const char *t = buf;
             const char *u = sep + 1;
             printf("Temperatura: %s C, Umidade: %s %%\n", t, u);
+
+            char *end_t, *end_u;
+            double vals[SERIE_VALUES] = { strtod(t, &end_t), strtod(u, &end_u) };
+            sensor_t *s = NULL;
+            if (end_t == t || end_u == u) met_add(M_INVALIDAS, 1);
+            else s = find_sensor(&from);
+            if (s) {
+                size_t before = serie_bytes(&s->serie);
+                uint64_t samples = s->serie.samples;
+                serie_trim(&s->serie, now - retention_ms);
+                if (serie_append(&s->serie, now, vals) < 0) met_add(M_RECUSADAS, 1);
+                met_add(M_AMOSTRAS, (int64_t)s->serie.samples - (int64_t)samples);
+                met_add(M_SERIE_BYTES, (int64_t)serie_bytes(&s->serie) - (int64_t)before);
+            } else if (end_t != t && end_u != u) {
+                met_add(M_RECUSADAS, 1);
+            }
         } else {
             // Caso mensagem fora do formato, mostra bruta
+            met_add(M_INVALIDAS, 1);
             printf("Mensagem bruta: %s\n", buf);
         }
 
@@ -2,6 +2,9 @@
  * servidorMonoUDP.c
  *
  * Mantém o estado (posX|posY|tam) e distribui atualizações para todos os clientes que enviam mensagens.
+ *
+ * Compilar: gcc -Wall desafio2_servidor.c -o servidor_estado -lpthread
+ * Uso:      ./servidor_estado [-m socket_metricas]
  */
 
 #include <stdio.h>
@@ -15,10 +18,32 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "metricas.h"
+
 #define SIZE 500
 #define SERVER_PORT 4567
 #define MAX_CLIENTS 100
 
+// Metricas (mesma ordem de MET_DEFS)
+enum {
+    M_PACOTES_IN, M_PACOTES_OUT, M_INVALIDAS, M_DESCARTES, M_ERROS_ENVIO,
+    M_CLIENTES, M_RECUSADOS, M_COUNT
+};
+
+static const met_def_t MET_DEFS[] = {
+    { .name = "estado_pacotes_recebidos_total", .help = "Datagramas recebidos", .type = MET_COUNTER },
+    { .name = "estado_pacotes_enviados_total", .help = "Datagramas de estado enviados", .type = MET_COUNTER },
+    { .name = "estado_mensagens_invalidas_total", .help = "Mensagens fora do formato posX|posY|tam",
+      .type = MET_COUNTER },
+    { .name = "estado_descartes_kernel_total", .help = "Datagramas descartados pelo kernel (fila do socket cheia)",
+      .type = MET_COUNTER },
+    { .name = "estado_erros_envio_total", .help = "Falhas de sendto na difusao", .type = MET_COUNTER },
+    { .name = "estado_clientes", .help = "Clientes na lista de difusao (fan-out de cada atualizacao)",
+      .type = MET_GAUGE },
+    { .name = "estado_clientes_recusados_total", .help = "Datagramas de clientes novos com a lista cheia",
+      .type = MET_COUNTER },
+};
+
 int main(int argc, char *argv[]) {
     int sockId, recvBytes;
     socklen_t addrLen;
@@ -32,11 +57,24 @@ int main(int argc, char *argv[]) {
     struct sockaddr_in clients[MAX_CLIENTS];
     int clientCount = 0;
 
+    const char *metrics_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:")) != -1) {
+        if (opt == 'm') metrics_path = optarg;
+        else { printf("Uso: %s [-m socket_metricas]\n", argv[0]); return 1; }
+    }
+    met_init(MET_DEFS, sizeof(MET_DEFS) / sizeof(MET_DEFS[0]));
+    if (metrics_path && met_serve(metrics_path) < 0) return 1;
+
     if ((sockId = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
        printf("Datagram socket nao pode ser aberto\n");
        return 1;
     }
 
+    // O kernel informa em cada datagrama quantos ja descartou por fila cheia
+    int yes = 1;
+    setsockopt(sockId, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(yes));
+
     server.sin_family = AF_INET;
     server.sin_addr.s_addr = INADDR_ANY;
     server.sin_port = htons(SERVER_PORT);
@@ -52,12 +90,27 @@ int main(int argc, char *argv[]) {
 
     while (1) {
         // recebe de qualquer cliente
-        recvBytes = recvfrom(sockId, buf, SIZE-1, 0, (struct sockaddr *)&clientAddr, &addrLen);
+        struct iovec iov = { buf, SIZE-1 };
+        char ctrl[CMSG_SPACE(sizeof(uint32_t))];
+        struct msghdr msg = {
+            .msg_name = &clientAddr, .msg_namelen = addrLen,
+            .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = ctrl, .msg_controllen = sizeof(ctrl),
+        };
+        recvBytes = recvmsg(sockId, &msg, 0);
         if (recvBytes < 0) {
-            perror("recvfrom");
+            perror("recvmsg");
             continue;
         }
         buf[recvBytes] = '\0';
+        met_add(M_PACOTES_IN, 1);
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+                met_set(M_DESCARTES, drops);
+            }
+        }
 
         // registra cliente se novo (compara IP e porta)
         int found = 0;
@@ -68,8 +121,10 @@ int main(int argc, char *argv[]) {
                 break;
             }
         }   
+        if (!found && clientCount == MAX_CLIENTS) met_add(M_RECUSADOS, 1);
         if (!found && clientCount < MAX_CLIENTS) {
             clients[clientCount++] = clientAddr;
+            met_set(M_CLIENTES, clientCount);
             printf("Novo cliente registrado: %s:%d\n",
                    inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port));
         }
@@ -82,6 +137,7 @@ int main(int argc, char *argv[]) {
                    inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port),
                     posX, posY, tam);
         } else {
+            met_add(M_INVALIDAS, 1);
             printf("Mensagem invalida de %s:%d -> %s\n",
                    inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port), buf);
             // NÃO prossegue em broadcast se inválida; continue;
@@ -93,6 +149,9 @@ int main(int argc, char *argv[]) {
         for (int i = 0; i < clientCount; ++i) {
             if (sendto(sockId, out, len+1, 0, (struct sockaddr *)&clients[i], sizeof(clients[i])) < 0) {
                 perror("sendto");
+                met_add(M_ERROS_ENVIO, 1);
+            } else {
+                met_add(M_PACOTES_OUT, 1);
             }
         }
     }
@@ -0,0 +1,80 @@
+/*
+ * desafio3_bot.h - Jogador automatico perfeito para o Jogo da Velha
+ *
+ * bot_init_tables() resolve o jogo inteiro por minimax na inicializacao e
+ * guarda a melhor jogada de cada um dos 3^9 estados do tabuleiro. Depois
+ * disso bot_pick() e uma unica consulta a tabela, sem busca.
+ *
+ * Indice de um estado: soma de 3^i * c_i, com c_i = 0 (vazia), 1 (X) ou
+ * 2 (O); calculado das mascaras por duas consultas a b3_lut.
+ */
+
+#ifndef DESAFIO3_BOT_H
+#define DESAFIO3_BOT_H
+
+#include <stdint.h>
+
+#include "desafio3_tabuleiro.h"
+
+#define BOT_STATES 19683        // 3^9
+#define BOT_NO_MOVE 0xFF
+
+static uint16_t b3_lut[BOARD_MASK + 1];   // mascara -> soma de 3^i dos bits
+static uint8_t bot_best[BOT_STATES];      // melhor casa para quem joga
+static int8_t bot_score[BOT_STATES];      // valor do estado para quem joga
+static uint8_t bot_known[BOT_STATES];
+
+static inline unsigned bot_index(uint16_t x, uint16_t o) {
+    return (unsigned)b3_lut[x] + 2u * b3_lut[o];
+}
+
+/*
+ * Negamax com memo. Derrota vale -(casas livres + 1), vitoria o oposto:
+ * entre jogadas vencedoras escolhe a mais rapida, e entre perdedoras a
+ * mais demorada.
+ */
+static inline int bot_solve(uint16_t x, uint16_t o) {
+    unsigned idx = bot_index(x, o);
+    if (bot_known[idx]) return bot_score[idx];
+
+    int x_turn = __builtin_popcount(x) == __builtin_popcount(o);
+    uint16_t opp = x_turn ? o : x;
+    uint16_t occ = x | o;
+    int empty = BOARD_CELLS - __builtin_popcount(occ);
+    int best = -100;
+    uint8_t move = BOT_NO_MOVE;
+
+    if (board_wins(opp)) {
+        best = -(empty + 1);
+    } else if (empty == 0) {
+        best = 0;
+    } else {
+        for (int i = 0; i < BOARD_CELLS; i++) {
+            uint16_t bit = (uint16_t)(1u << i);
+            if (occ & bit) continue;
+            int s = x_turn ? -bot_solve(x | bit, o) : -bot_solve(x, o | bit);
+            if (s > best) { best = s; move = (uint8_t)i; }
+        }
+    }
+    bot_known[idx] = 1;
+    bot_score[idx] = (int8_t)best;
+    bot_best[idx] = move;
+    return best;
+}
+
+static inline void bot_init_tables(void) {
+    for (int m = 0; m <= BOARD_MASK; m++) {
+        unsigned v = 0, p = 1;
+        for (int i = 0; i < BOARD_CELLS; i++, p *= 3)
+            if ((m >> i) & 1) v += p;
+        b3_lut[m] = (uint16_t)v;
+    }
+    bot_solve(0, 0);
+}
+
+// Melhor casa para o lado da vez, ou BOT_NO_MOVE se o jogo acabou.
+static inline uint8_t bot_pick(uint16_t x, uint16_t o) {
+    return bot_best[bot_index(x, o)];
+}
+
+#endif
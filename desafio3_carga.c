@@ -0,0 +1,449 @@
+/*
+ * Gerador de carga - Jogo da Velha
+ * Compilar: gcc -Wall -O2 desafio3_carga.c -o carga_velha
+ * Uso:      ./carga_velha [-c conexoes] [-d segundos] [-b] [-r] [-s semente] <host> <porta>
+ *           -c  conexoes simultaneas (padrão: 1000)
+ *           -d  duracao do teste em segundos (padrão: 10)
+ *           -b  negocia o protocolo binario
+ *           -r  jogadas roteirizadas (menor casa livre) em vez de aleatorias
+ *
+ * Uma unica thread com epoll mantem todas as conexoes abertas: cada uma
+ * joga partidas completas com jogadas validas e, ao receber BYE,
+ * reconecta para a proxima. Ao final imprime partidas/s, percentis do
+ * tempo entre MOVE e OK MOVE e as contagens de erros e desconexoes.
+ * Se socket() ou connect() falham na hora (EMFILE, EADDRNOTAVAIL com as
+ * portas efemeras esgotadas), a conexao vai para uma lista de espera e
+ * e tentada de novo a cada RETRY_MS; o relatorio mostra quantas estao la.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "desafio3_protocolo.h"
+
+#define DEFAULT_CONNS    1000
+#define DEFAULT_SECONDS  10
+#define MAX_EVENTS       1024
+#define REPORT_MS        1000
+#define RETRY_MS         100     // nova tentativa das conexoes que falharam na hora
+
+enum { C_CONNECTING, C_HANDSHAKE, C_PLAYING };
+
+typedef struct conn {
+    int fd;
+    int state;              // C_*
+    int proto;              // protocolo de recepcao
+    int slot;               // 0 = X, 1 = O, -1 antes do ASSIGN
+    int got_bye;
+    uint16_t marks[2];
+    int pending;            // MOVE enviado, aguardando OK MOVE
+    uint64_t sent_ns;
+    linebuf_t lb;
+    struct conn *retry_next;    // lista de espera por nova tentativa
+} conn_t;
+
+static struct sockaddr_in server;
+static int epfd;
+static int use_bin = 0;
+static int scripted = 0;
+static uint64_t rng_state;
+
+// Contadores
+static uint64_t matches, moves, wins[2], draws, opp_left;
+static uint64_t connects, connect_errors, disconnects;
+static uint64_t errs[ERR_COUNT + 1];    // ERR_COUNT: texto desconhecido
+
+// Conexoes sem socket esperando nova tentativa
+static conn_t *retry_head;
+static int retry_count;
+static int retry_errno;                 // ultimo erro de socket()/connect() imediato
+
+// Amostras de tempo de resposta (us)
+static uint32_t *rtt;
+static size_t rtt_n, rtt_cap;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t rng_next(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static void rtt_add(uint64_t ns) {
+    if (rtt_n == rtt_cap) {
+        size_t cap = rtt_cap ? rtt_cap * 2 : 1 << 16;
+        uint32_t *n = (uint32_t *)realloc(rtt, cap * sizeof(uint32_t));
+        if (!n) return;
+        rtt = n;
+        rtt_cap = cap;
+    }
+    uint64_t us = ns / 1000;
+    rtt[rtt_n++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void send_msg(conn_t *c, const msg_t *m) {
+    uint8_t out[MSG_MAX];
+    size_t len = MSG_ENCODE[c->proto](m, out);
+    send(c->fd, out, len, MSG_NOSIGNAL);
+}
+
+static void conn_retry_later(conn_t *c) {
+    retry_errno = errno;
+    connect_errors++;
+    c->retry_next = retry_head;
+    retry_head = c;
+    retry_count++;
+}
+
+static void conn_open(conn_t *c) {
+    memset(c, 0, sizeof(*c));
+    c->slot = -1;
+    lb_init(&c->lb);
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) { conn_retry_later(c); return; }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *)&server, sizeof(server)) < 0 && errno != EINPROGRESS) {
+        int err = errno;
+        close(c->fd);
+        c->fd = -1;
+        errno = err;
+        conn_retry_later(c);
+        return;
+    }
+    c->state = C_CONNECTING;
+    struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+// Reabre as conexoes da lista de espera; as que falharem de novo voltam para ela.
+static void conn_retry_all(void) {
+    conn_t *c = retry_head;
+    retry_head = NULL;
+    retry_count = 0;
+    while (c) {
+        conn_t *next = c->retry_next;
+        conn_open(c);
+        c = next;
+    }
+}
+
+static void conn_close(conn_t *c) {
+    if (c->fd < 0) return;
+    if (!c->got_bye) disconnects++;
+    close(c->fd);   // remove do epoll
+    c->fd = -1;
+}
+
+static void play(conn_t *c) {
+    uint16_t free_cells = (uint16_t)(~(c->marks[0] | c->marks[1]) & BOARD_MASK);
+    if (!free_cells) return;
+    int pos;
+    if (scripted) {
+        pos = __builtin_ctz(free_cells);
+    } else {
+        int k = (int)(rng_next() % (uint64_t)__builtin_popcount(free_cells));
+        while (k--) free_cells &= (uint16_t)(free_cells - 1);
+        pos = __builtin_ctz(free_cells);
+    }
+    msg_t m = { .op = OP_MOVE, .arg = (uint8_t)pos };
+    c->pending = 1;
+    c->sent_ns = now_ns();
+    send_msg(c, &m);
+}
+
+/* Tratadores de mensagens do servidor. Retornam 1 para encerrar a conexao. */
+
+typedef int (*rx_handler_t)(conn_t *c, const msg_t *m);
+
+static int on_assign(conn_t *c, const msg_t *m) {
+    c->slot = (char)m->arg == BOARD_SYMBOLS[0] ? 0 : 1;
+    return 0;
+}
+
+static int on_board(conn_t *c, const msg_t *m) {
+    c->marks[0] = m->marks[0];
+    c->marks[1] = m->marks[1];
+    return 0;
+}
+
+static int on_turn(conn_t *c, const msg_t *m) {
+    if (c->slot >= 0 && (char)m->arg == BOARD_SYMBOLS[c->slot] && !c->pending) play(c);
+    return 0;
+}
+
+static int on_ok_move(conn_t *c, const msg_t *m) {
+    (void)m;
+    if (!c->pending) return 0;     // jogada do oponente
+    rtt_add(now_ns() - c->sent_ns);
+    c->pending = 0;
+    moves++;
+    return 0;
+}
+
+static int on_err(conn_t *c, const msg_t *m) {
+    int code = m->arg;
+    if (code >= ERR_COUNT && m->text) {
+        // texto: recupera o codigo pela descricao
+        for (code = 0; code < ERR_COUNT; code++)
+            if (strcmp(m->text, ERR_TEXT[code]) == 0) break;
+    }
+    errs[code < ERR_COUNT ? code : ERR_COUNT]++;
+    c->pending = 0;
+    return 0;
+}
+
+// Resultados contados so pelo X, que e sempre uma conexao desta carga
+static int on_win(conn_t *c, const msg_t *m) {
+    if (c->slot == 0) wins[(char)m->arg == BOARD_SYMBOLS[0] ? 0 : 1]++;
+    return 0;
+}
+
+static int on_draw(conn_t *c, const msg_t *m) {
+    (void)m;
+    if (c->slot == 0) draws++;
+    return 0;
+}
+
+static int on_opp_left(conn_t *c, const msg_t *m) {
+    (void)c; (void)m;
+    opp_left++;
+    return 0;
+}
+
+static int on_bye(conn_t *c, const msg_t *m) {
+    (void)m;
+    if (c->slot == 0) matches++;
+    c->got_bye = 1;
+    return 1;
+}
+
+static const rx_handler_t RX_HANDLERS[OP_COUNT] = {
+    [OP_ASSIGN]   = on_assign,
+    [OP_BOARD]    = on_board,
+    [OP_TURN]     = on_turn,
+    [OP_OK_MOVE]  = on_ok_move,
+    [OP_ERR]      = on_err,
+    [OP_WIN]      = on_win,
+    [OP_DRAW]     = on_draw,
+    [OP_OPP_LEFT] = on_opp_left,
+    [OP_BYE]      = on_bye,
+};
+
+static int dispatch(conn_t *c, const msg_t *m, int rc) {
+    if (rc != MSG_OK || !RX_HANDLERS[m->op]) return 0;
+    return RX_HANDLERS[m->op](c, m);
+}
+
+// Le e trata tudo o que chegou. Retorna 1 se a conexao deve ser fechada.
+static int conn_read(conn_t *c) {
+    while (1) {
+        ssize_t r = lb_fill(&c->lb, c->fd);
+        if (r == 0) return 1;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        }
+
+        msg_t m;
+        if (c->state == C_HANDSHAKE) {
+            // o estado completo e reenviado apos a confirmacao do binario
+            const char *line;
+            size_t len;
+            while (lb_next(&c->lb, &line, &len)) {
+                if (strcmp(line, PROTO_ACK_BIN) == 0) {
+                    c->state = C_PLAYING;
+                    c->proto = PROTO_BIN;
+                    break;
+                }
+                if (msg_decode_text(line, &m) == MSG_OK && m.op == OP_BYE) return 1;
+            }
+            if (c->state == C_HANDSHAKE) continue;
+        }
+
+        if (c->proto == PROTO_BIN) {
+            const uint8_t *f;
+            size_t len;
+            while (lb_next_frame(&c->lb, &f, &len))
+                if (dispatch(c, &m, msg_decode_bin(f, len, &m))) return 1;
+        } else {
+            const char *line;
+            size_t len;
+            while (lb_next(&c->lb, &line, &len))
+                if (dispatch(c, &m, msg_decode_text(line, &m))) return 1;
+        }
+    }
+}
+
+// Trata um evento do epoll; conexoes encerradas sao reabertas na hora.
+static void conn_event(conn_t *c, uint32_t events) {
+    if (c->state == C_CONNECTING) {
+        int err = 0;
+        socklen_t elen = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+        if (err || (events & (EPOLLERR | EPOLLHUP))) {
+            connect_errors++;
+            close(c->fd);
+            c->fd = -1;
+            conn_open(c);
+            return;
+        }
+        connects++;
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        if (use_bin) {
+            send(c->fd, PROTO_HELLO_BIN "\n", sizeof(PROTO_HELLO_BIN), MSG_NOSIGNAL);
+            c->state = C_HANDSHAKE;
+        } else {
+            c->state = C_PLAYING;
+        }
+        return;
+    }
+    if (conn_read(c) || (events & (EPOLLERR | EPOLLHUP))) {
+        conn_close(c);
+        conn_open(c);
+    }
+}
+
+static void print_summary(double secs) {
+    printf("\nDuracao: %.1f s\n", secs);
+    printf("Conexoes: %llu (falhas de connect %llu, desconexoes antes do BYE %llu)\n",
+           (unsigned long long)connects, (unsigned long long)connect_errors,
+           (unsigned long long)disconnects);
+    if (retry_count)
+        printf("Sem conexao ao final: %d (ultimo erro: %s)\n", retry_count, strerror(retry_errno));
+    printf("Partidas: %llu (%.1f/s) X venceu %llu, O venceu %llu, empates %llu, OPP_LEFT %llu\n",
+           (unsigned long long)matches, (double)matches / secs,
+           (unsigned long long)wins[0], (unsigned long long)wins[1],
+           (unsigned long long)draws, (unsigned long long)opp_left);
+    printf("Jogadas: %llu (%.1f/s)\n", (unsigned long long)moves, (double)moves / secs);
+    if (rtt_n) {
+        qsort(rtt, rtt_n, sizeof(uint32_t), cmp_u32);
+        static const double P[] = { 50, 90, 99, 99.9 };
+        printf("MOVE -> OK MOVE (us):");
+        for (size_t i = 0; i < sizeof(P) / sizeof(P[0]); i++) {
+            size_t k = (size_t)(P[i] / 100.0 * (double)(rtt_n - 1));
+            printf(" p%g=%u", P[i], rtt[k]);
+        }
+        printf(" max=%u\n", rtt[rtt_n - 1]);
+    }
+    uint64_t total = 0;
+    for (int i = 0; i <= ERR_COUNT; i++) total += errs[i];
+    if (total) {
+        printf("Erros recebidos: %llu\n", (unsigned long long)total);
+        for (int i = 0; i <= ERR_COUNT; i++)
+            if (errs[i]) printf("  %s: %llu\n", i < ERR_COUNT ? ERR_TEXT[i] : "?", (unsigned long long)errs[i]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int nconn = DEFAULT_CONNS, seconds = DEFAULT_SECONDS;
+    rng_state = (uint64_t)time(NULL) | 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:brs:")) != -1) {
+        switch (opt) {
+        case 'c': nconn = atoi(optarg); break;
+        case 'd': seconds = atoi(optarg); break;
+        case 'b': use_bin = 1; break;
+        case 'r': scripted = 1; break;
+        case 's': rng_state = strtoull(optarg, NULL, 10) | 1; break;
+        default:
+            printf("Uso: %s [-c conexoes] [-d segundos] [-b] [-r] [-s semente] <host> <porta>\n", argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2 || nconn < 1 || seconds < 1) {
+        printf("Uso: %s [-c conexoes] [-d segundos] [-b] [-r] [-s semente] <host> <porta>\n", argv[0]);
+        return 1;
+    }
+    const char *host = argv[optind], *port_str = argv[optind + 1];
+    struct hostent *hp = gethostbyname(host);
+    if (!hp) { printf("Host invalido: %s\n", host); return 1; }
+    int port = atoi(port_str);
+    if (port <= 0 || port > 65535) { printf("Porta invalida: %s\n", port_str); return 1; }
+    memset(&server, 0, sizeof(server));
+    memcpy(&server.sin_addr, hp->h_addr, hp->h_length);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+
+    // milhares de conexoes: sobe o limite de descritores ate o maximo permitido
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    board_init_tables();
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) { perror("epoll_create1"); return 1; }
+    conn_t *conns = (conn_t *)calloc((size_t)nconn, sizeof(conn_t));
+    if (!conns) { perror("calloc"); return 1; }
+    for (int i = 0; i < nconn; i++) conn_open(&conns[i]);
+
+    uint64_t t0 = now_ns(), end = t0 + (uint64_t)seconds * 1000000000ull;
+    uint64_t last = t0, last_retry = t0, last_matches = 0, last_moves = 0;
+    struct epoll_event evs[MAX_EVENTS];
+    while (now_ns() < end) {
+        int n = epoll_wait(epfd, evs, MAX_EVENTS, 100);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) conn_event((conn_t *)evs[i].data.ptr, evs[i].events);
+
+        uint64_t now = now_ns();
+        if (retry_head && now - last_retry >= RETRY_MS * 1000000ull) {
+            conn_retry_all();
+            last_retry = now;
+        }
+        if (now - last >= REPORT_MS * 1000000ull) {
+            double dt = (double)(now - last) / 1e9;
+            int open = 0;
+            for (int i = 0; i < nconn; i++) open += conns[i].fd >= 0;
+            printf("t=%.0fs partidas=%llu (%.1f/s) jogadas/s=%.1f conexoes=%d erros=%llu",
+                   (double)(now - t0) / 1e9, (unsigned long long)matches,
+                   (double)(matches - last_matches) / dt, (double)(moves - last_moves) / dt, open,
+                   (unsigned long long)(connect_errors + disconnects));
+            if (retry_count) printf(" sem conexao=%d (%s)", retry_count, strerror(retry_errno));
+            printf("\n");
+            fflush(stdout);
+            last = now; last_matches = matches; last_moves = moves;
+        }
+    }
+
+    // Conexoes no meio de uma partida nao contam como desconexao
+    for (int i = 0; i < nconn; i++) {
+        if (conns[i].fd < 0) continue;
+        close(conns[i].fd);
+        conns[i].fd = -1;
+    }
+    print_summary((double)(now_ns() - t0) / 1e9);
+    free(conns);
+    free(rtt);
+    return 0;
+}
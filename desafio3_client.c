@@ -1,7 +1,9 @@
 /*
  * Cliente TCP - Jogo da Velha
  * Compilar: gcc -Wall -lpthread desafio3_client.c -o cliente_velha
- * Uso:      ./cliente_velha <host> <porta>
+ * Uso:      ./cliente_velha [-b] [-w sala] <host> <porta>
+ *           -b       negocia o protocolo binario
+ *           -w sala  assiste a sala (use a porta de espectadores do servidor)
  */
 
 #include <sys/types.h>
@@ -13,13 +15,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdlib.h>
-#include <stdarg.h>
+
+#include "desafio3_protocolo.h"
 
 #define MAX_FLOW_SIZE 1024
 
 static int sockId = -1;
+static int proto = PROTO_TEXT;   // protocolo usado no envio
 static char my_sym = '?';
+static int watching = 0;         // 1 quando conectado como espectador
 static int my_turn = 0;
 static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
 
@@ -37,102 +41,161 @@ static void print_board(const char *s) {
     printf("Posicoes: 0 1 2 / 3 4 5 / 6 7 8\n");
 }
 
-static void send_line(const char *fmt, ...) {
-    char out[MAX_FLOW_SIZE];
-    va_list ap; va_start(ap, fmt);
-    vsnprintf(out, sizeof(out), fmt, ap);
-    va_end(ap);
-    size_t len = strnlen(out, sizeof(out));
-    if (len == 0 || out[len-1] != '\n') {
-        if (len + 1 < sizeof(out)) { out[len] = '\n'; out[len+1] = '\0'; len++; }
-    }
+static void send_op(uint8_t op, uint8_t arg) {
+    uint8_t out[MSG_MAX];
+    msg_t m = { .op = op, .arg = arg };
+    size_t len = MSG_ENCODE[proto](&m, out);
     send(sockId, out, len, 0);
 }
 
-static int recv_line(int fd, char *buf, size_t n, char *carry, size_t *carry_len) {
-    size_t len = *carry_len;
-    memcpy(buf, carry, len);
-    while (1) {
-        for (size_t i = 0; i < len; i++) {
-            if (buf[i] == '\n') {
-                buf[i] = '\0';
-                size_t rest = len - (i + 1);
-                memmove(carry, buf + i + 1, rest);
-                *carry_len = rest;
-                return 1;
-            }
-        }
-        if (len + 1 >= n) { buf[n-1] = '\0'; *carry_len = 0; return 1; }
-        ssize_t r = recv(fd, buf + len, n - 1 - len, 0);
-        if (r <= 0) return 0;
-        len += (size_t)r;
+/* Tratadores de mensagens do servidor, indexados por opcode */
+
+static void on_assign(const msg_t *m) {
+    pthread_mutex_lock(&mut);
+    my_sym = (char)m->arg;
+    pthread_mutex_unlock(&mut);
+    printf("Voce eh o jogador %c\n", my_sym);
+}
+
+static void on_waiting(const msg_t *m) {
+    printf("Aguardando outro jogador... (%d/2)\n", m->arg);
+}
+
+static void on_start(const msg_t *m) {
+    (void)m;
+    printf("Partida iniciada!\n");
+}
+
+static void on_board(const msg_t *m) {
+    char b[BOARD_CELLS + 1];
+    board_render(m->marks[0], m->marks[1], b);
+    print_board(b);
+}
+
+static void on_turn(const msg_t *m) {
+    char t = (char)m->arg;
+    pthread_mutex_lock(&mut);
+    my_turn = (t == my_sym);
+    pthread_mutex_unlock(&mut);
+    if (watching) {
+        printf("Vez de %c\n", t);
+    } else if (my_turn) {
+        printf("Sua vez (%c). Digite posicao [0-8] ou END para sair:\n", my_sym);
+    } else {
+        printf("Vez do oponente (%c)...\n", t);
     }
 }
 
+static void on_err(const msg_t *m) {
+    printf("Erro: %s\n", m->text);
+}
+
+static void on_win(const msg_t *m) {
+    char w = (char)m->arg;
+    if (watching) printf("Vencedor: %c\n", w);
+    else if (w == my_sym) printf("Voce venceu!\n");
+    else printf("Voce perdeu.\n");
+}
+
+static void on_draw(const msg_t *m) {
+    (void)m;
+    printf("Empate.\n");
+}
+
+static void on_opp_left(const msg_t *m) {
+    (void)m;
+    if (watching) printf("Um jogador desconectou. Partida encerrada.\n");
+    else printf("Oponente desconectou. Partida encerrada.\n");
+}
+
+static void on_room(const msg_t *m) {
+    printf("Sala %u\n", m->id);
+}
+
+static void on_bye(const msg_t *m) {
+    (void)m;
+    printf("Servidor finalizou a partida.\n");
+    exit(0);
+}
+
+typedef void (*rx_handler_t)(const msg_t *m);
+
+// OK MOVE (eco do servidor) e mensagens desconhecidas sao ignoradas
+static const rx_handler_t RX_HANDLERS[OP_COUNT] = {
+    [OP_ASSIGN]   = on_assign,
+    [OP_WAITING]  = on_waiting,
+    [OP_START]    = on_start,
+    [OP_BOARD]    = on_board,
+    [OP_TURN]     = on_turn,
+    [OP_ERR]      = on_err,
+    [OP_WIN]      = on_win,
+    [OP_DRAW]     = on_draw,
+    [OP_OPP_LEFT] = on_opp_left,
+    [OP_BYE]      = on_bye,
+    [OP_ROOM]     = on_room,
+};
+
+/*
+ * Mensagens em texto anteriores a "PROTO BIN OK" que sao tratadas. O
+ * estado da sala (ASSIGN, ROOM, START, BOARD, TURN) e reenviado depois da
+ * confirmacao e fica de fora; espera, erros e fim de partida (servidor
+ * cheio, tempo esgotado na fila) nao se repetem.
+ */
+static const uint8_t PRE_ACK[OP_COUNT] = {
+    [OP_WAITING] = 1, [OP_ERR] = 1, [OP_WIN] = 1, [OP_DRAW] = 1,
+    [OP_OPP_LEFT] = 1, [OP_BYE] = 1,
+};
+
 static void *rx_thread(void *arg) {
     (void)arg;
-    char line[MAX_FLOW_SIZE];
-    char carry[MAX_FLOW_SIZE]; size_t carry_len = 0;
+    linebuf_t lb; lb_init(&lb);
+    int rx_proto = PROTO_TEXT;
+
+    if (proto == PROTO_BIN) {
+        const char *line;
+        while (1) {
+            if (!lb_recv_line(&lb, sockId, &line)) {
+                printf("Conexao encerrada.\n");
+                exit(0);
+            }
+            if (strcmp(line, PROTO_ACK_BIN) == 0) break;
+            msg_t m;
+            if (msg_decode_text(line, &m) == MSG_OK && PRE_ACK[m.op] && RX_HANDLERS[m.op])
+                RX_HANDLERS[m.op](&m);
+        }
+        rx_proto = PROTO_BIN;
+    }
 
     while (1) {
-        int ok = recv_line(sockId, line, sizeof(line), carry, &carry_len);
-        if (!ok) {
+        msg_t m;
+        int rc;
+        if (!msg_recv(&lb, sockId, rx_proto, &m, &rc)) {
             printf("Conexao encerrada.\n");
             exit(0);
         }
-        if (strncmp(line, "ASSIGN ", 7) == 0) {
-            pthread_mutex_lock(&mut);
-            my_sym = line[7];
-            pthread_mutex_unlock(&mut);
-            printf("Voce eh o jogador %c\n", my_sym);
-        } else if (strncmp(line, "WAITING ", 8) == 0) {
-            printf("Aguardando outro jogador... (%s)\n", line + 8);
-        } else if (strcmp(line, "START") == 0) {
-            printf("Partida iniciada!\n");
-        } else if (strncmp(line, "BOARD ", 6) == 0) {
-            print_board(line + 6);
-        } else if (strncmp(line, "TURN ", 5) == 0) {
-            char t = line[5];
-            pthread_mutex_lock(&mut);
-            my_turn = (t == my_sym);
-            pthread_mutex_unlock(&mut);
-            if (my_turn) {
-                printf("Sua vez (%c). Digite posicao [0-8] ou END para sair:\n", my_sym);
-            } else {
-                printf("Vez do oponente (%c)...\n", t);
-            }
-        } else if (strncmp(line, "OK MOVE ", 8) == 0) {
-            // opcional: eco do servidor
-        } else if (strncmp(line, "ERR ", 4) == 0) {
-            printf("Erro: %s\n", line + 4);
-        } else if (strncmp(line, "WIN ", 4) == 0) {
-            char w = line[4];
-            if (w == my_sym) printf("Voce venceu!\n");
-            else printf("Voce perdeu.\n");
-        } else if (strcmp(line, "DRAW") == 0) {
-            printf("Empate.\n");
-        } else if (strcmp(line, "OPP_LEFT") == 0) {
-            printf("Oponente desconectou. Partida encerrada.\n");
-        } else if (strcmp(line, "BYE") == 0) {
-            printf("Servidor finalizou a partida.\n");
-            exit(0);
-        } else {
-            // outras infos
-            // printf("Srv: %s\n", line);
-        }
+        if (rc == MSG_OK && RX_HANDLERS[m.op]) RX_HANDLERS[m.op](&m);
     }
     return NULL;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Uso: %s <host> <porta>\n", argv[0]);
+    int use_bin = 0;
+    long watch_room = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "bw:")) != -1) {
+        if (opt == 'b') use_bin = 1;
+        else if (opt == 'w') { watching = 1; watch_room = strtol(optarg, NULL, 10); }
+        else { printf("Uso: %s [-b] [-w sala] <host> <porta>\n", argv[0]); return 1; }
+    }
+    if (argc - optind != 2) {
+        printf("Uso: %s [-b] [-w sala] <host> <porta>\n", argv[0]);
         return 1;
     }
-    struct hostent *hp = gethostbyname(argv[1]);
-    if (!hp) { printf("Host invalido: %s\n", argv[1]); return 1; }
-    int port = atoi(argv[2]);
-    if (port <= 0 || port > 65535) { printf("Porta invalida: %s\n", argv[2]); return 1; }
+    const char *host = argv[optind], *port_str = argv[optind + 1];
+    struct hostent *hp = gethostbyname(host);
+    if (!hp) { printf("Host invalido: %s\n", host); return 1; }
+    int port = atoi(port_str);
+    if (port <= 0 || port > 65535) { printf("Porta invalida: %s\n", port_str); return 1; }
 
     struct sockaddr_in server;
     memset(&server, 0, sizeof(server));
@@ -149,6 +212,18 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (watching) {
+        // espectadores recebem sempre texto
+        msg_t w = { .op = OP_WATCH, .id = (uint32_t)watch_room };
+        uint8_t out[MSG_MAX];
+        send(sockId, out, msg_encode_text(&w, out), 0);
+    } else if (use_bin) {
+        send(sockId, PROTO_HELLO_BIN "\n", sizeof(PROTO_HELLO_BIN), 0);
+        proto = PROTO_BIN;
+    }
+
+    board_init_tables();
+
     pthread_t th;
     pthread_create(&th, NULL, rx_thread, NULL);
     pthread_detach(th);
@@ -160,13 +235,17 @@ int main(int argc, char *argv[]) {
         size_t len = strlen(in);
         if (len && in[len-1] == '\n') in[len-1] = '\0';
         if (strcasecmp(in, "END") == 0) {
-            send_line("END");
+            send_op(OP_END, 0);
             break;
         }
         // tenta interpretar como posicao
         char *end = NULL;
         long v = strtol(in, &end, 10);
         if (end != in && *end == '\0') {
+            if (watching) {
+                printf("Espectador nao joga. Digite END para sair.\n");
+                continue;
+            }
             pthread_mutex_lock(&mut);
             int can = my_turn;
             pthread_mutex_unlock(&mut);
@@ -178,7 +257,7 @@ int main(int argc, char *argv[]) {
                 printf("Posicao invalida. Use 0..8.\n");
                 continue;
             }
-            send_line("MOVE %ld", v);
+            send_op(OP_MOVE, (uint8_t)v);
         } else {
             printf("Comando invalido. Use [0-8] para jogar ou END para sair.\n");
         }
@@ -0,0 +1,44 @@
+/*
+ * desafio3_diario.h - Formato do diario de partidas do Jogo da Velha
+ *
+ * Arquivo binario so de acrescimo: um cabecalho de 16 bytes seguido de
+ * registros de 16 bytes, na ordem em que foram aceitos pelo servidor.
+ * Inteiros na ordem de bytes da maquina (little-endian no x86).
+ *
+ * Escrito pelo servidor (-j arquivo) e lido por desafio3_replay.c.
+ */
+
+#ifndef DESAFIO3_DIARIO_H
+#define DESAFIO3_DIARIO_H
+
+#include <stdint.h>
+
+#define JOURNAL_MAGIC   "VELHAJ01"
+#define JOURNAL_VERSION 2       // 2: resultado JR_TIMEOUT
+#define JOURNAL_VERSION_MIN 1   // mais antiga que o replay ainda le
+
+// Tipos de registro
+enum { JR_START = 1, JR_MOVE, JR_END };
+
+// JR_END: resultado
+enum { JR_WIN_X = 0, JR_WIN_O, JR_DRAW, JR_ABANDON, JR_TIMEOUT, JR_RESULTS };
+
+typedef struct {
+    char magic[8];          // JOURNAL_MAGIC, sem '\0'
+    uint32_t version;
+    uint32_t rec_size;      // sizeof(jrec_t)
+} jheader_t;
+
+typedef struct {
+    uint64_t ts_ns;         // CLOCK_REALTIME em ns
+    uint32_t room;
+    uint8_t type;           // JR_*
+    uint8_t a;              // START: 1 se ha bot; MOVE: assento; END: resultado
+    uint8_t b;              // MOVE: casa; END (abandono/tempo): assento de quem perdeu
+    uint8_t pad;
+} jrec_t;
+
+_Static_assert(sizeof(jheader_t) == 16, "cabecalho do diario deve ter 16 bytes");
+_Static_assert(sizeof(jrec_t) == 16, "registro do diario deve ter 16 bytes");
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * desafio3_fila.h - Fila MPMC limitada e sem travas
+ *
+ * Vetor circular com numero de sequencia por celula (algoritmo de
+ * D. Vyukov). Produtores e consumidores disputam apenas um contador
+ * atomico cada; nao ha mutex.
+ *
+ * O tipo do elemento e parametro: MPMC_DEFINE(nome, tipo) gera nome_t,
+ * nome_init, nome_push, nome_pop e nome_depth, com o valor copiado para
+ * dentro da celula. mpmc_t guarda ponteiros.
+ */
+
+#ifndef DESAFIO3_FILA_H
+#define DESAFIO3_FILA_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MPMC_DEFINE(name, type)                                                     \
+typedef struct {                                                                    \
+    _Atomic size_t seq;                                                             \
+    type val;                                                                       \
+} name##_cell_t;                                                                    \
+                                                                                    \
+typedef struct {                                                                    \
+    name##_cell_t *cells;                                                           \
+    size_t mask;                                                                    \
+    _Alignas(64) _Atomic size_t tail;   /* proxima posicao de escrita */            \
+    _Alignas(64) _Atomic size_t head;   /* proxima posicao de leitura */            \
+} name##_t;                                                                         \
+                                                                                    \
+/* cap deve ser potencia de 2. Retorna -1 se faltar memoria. */                     \
+static inline int name##_init(name##_t *q, size_t cap) {                            \
+    q->cells = (name##_cell_t *)malloc(cap * sizeof(name##_cell_t));                \
+    if (!q->cells) return -1;                                                       \
+    for (size_t i = 0; i < cap; i++) atomic_init(&q->cells[i].seq, i);              \
+    q->mask = cap - 1;                                                              \
+    atomic_init(&q->tail, 0);                                                       \
+    atomic_init(&q->head, 0);                                                       \
+    return 0;                                                                       \
+}                                                                                   \
+                                                                                    \
+/* Retorna -1 se a fila estiver cheia. */                                           \
+static inline int name##_push(name##_t *q, type v) {                                \
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);              \
+    for (;;) {                                                                      \
+        name##_cell_t *c = &q->cells[pos & q->mask];                                \
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);           \
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;                               \
+        if (dif == 0) {                                                             \
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,      \
+                    memory_order_relaxed, memory_order_relaxed)) {                  \
+                c->val = v;                                                         \
+                atomic_store_explicit(&c->seq, pos + 1, memory_order_release);      \
+                return 0;                                                           \
+            }                                                                       \
+        } else if (dif < 0) {                                                       \
+            return -1;                                                              \
+        } else {                                                                    \
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);             \
+        }                                                                           \
+    }                                                                               \
+}                                                                                   \
+                                                                                    \
+/* Retorna -1 se a fila estiver vazia. */                                           \
+static inline int name##_pop(name##_t *q, type *v) {                                \
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);              \
+    for (;;) {                                                                      \
+        name##_cell_t *c = &q->cells[pos & q->mask];                                \
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);           \
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);                         \
+        if (dif == 0) {                                                             \
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,      \
+                    memory_order_relaxed, memory_order_relaxed)) {                  \
+                *v = c->val;                                                        \
+                atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release); \
+                return 0;                                                           \
+            }                                                                       \
+        } else if (dif < 0) {                                                       \
+            return -1;                                                              \
+        } else {                                                                    \
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);             \
+        }                                                                           \
+    }                                                                               \
+}                                                                                   \
+                                                                                    \
+/* Tamanho aproximado (pode estar desatualizado sob concorrencia). */               \
+static inline size_t name##_depth(name##_t *q) {                                    \
+    size_t t = atomic_load_explicit(&q->tail, memory_order_relaxed);                \
+    size_t h = atomic_load_explicit(&q->head, memory_order_relaxed);                \
+    return t > h ? t - h : 0;                                                       \
+}
+
+MPMC_DEFINE(mpmc, void *)
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * desafio3_linha.h - Enquadramento de linhas do protocolo do Jogo da Velha
+ *
+ * Buffer circular por conexao, compartilhado por cliente e servidor.
+ * Os dados recebidos ficam no anel; a busca por '\n' continua de onde
+ * parou (memchr) e a linha e entregue como ponteiro para dentro do anel,
+ * sem copia. So quando a linha cruza o fim do anel ela e montada em um
+ * buffer auxiliar.
+ *
+ * O mesmo anel tambem entrega quadros binarios [tam][tam bytes], usados
+ * depois da negociacao do protocolo binario.
+ */
+
+#ifndef DESAFIO3_LINHA_H
+#define DESAFIO3_LINHA_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define LB_CAP      2048            // capacidade do anel (potencia de 2)
+#define LB_MASK     (LB_CAP - 1)
+#define LB_MAX_LINE 1024            // maior linha aceita, incluindo o '\0'
+
+typedef struct {
+    char data[LB_CAP];
+    char wrap[LB_MAX_LINE];  // linha que cruzou o fim do anel
+    size_t head;             // inicio dos dados nao consumidos (contador absoluto)
+    size_t scan;             // ate onde ja se procurou '\n'
+    size_t tail;             // fim dos dados recebidos
+} linebuf_t;
+
+static inline void lb_init(linebuf_t *lb) {
+    lb->head = lb->scan = lb->tail = 0;
+}
+
+// Copia [from, from+len) do anel para dst, tratando a volta.
+static inline void lb_copy_out(const linebuf_t *lb, char *dst, size_t from, size_t len) {
+    size_t off = from & LB_MASK;
+    size_t first = LB_CAP - off < len ? LB_CAP - off : len;
+    memcpy(dst, lb->data + off, first);
+    memcpy(dst + first, lb->data, len - first);
+}
+
+/*
+ * Extrai a proxima linha completa ja recebida. Retorna 1 e preenche
+ * *line (terminada em '\0', sem o '\n') e *len; retorna 0 se ainda nao
+ * ha linha completa. A linha vale ate a proxima chamada sobre o buffer.
+ * Linhas com LB_MAX_LINE bytes ou mais saem truncadas em LB_MAX_LINE - 1.
+ */
+static inline int lb_next(linebuf_t *lb, const char **line, size_t *len) {
+    while (lb->scan < lb->tail) {
+        size_t off = lb->scan & LB_MASK;
+        size_t seg = lb->tail - lb->scan;
+        if (seg > LB_CAP - off) seg = LB_CAP - off;
+        char *nl = memchr(lb->data + off, '\n', seg);
+        if (!nl) { lb->scan += seg; continue; }
+
+        size_t end = lb->scan + (size_t)(nl - (lb->data + off));
+        size_t n = end - lb->head;
+        size_t hoff = lb->head & LB_MASK;
+        if (n >= LB_MAX_LINE) {
+            // linha muito longa: entrega truncada e descarta o resto
+            n = LB_MAX_LINE - 1;
+            lb_copy_out(lb, lb->wrap, lb->head, n);
+            lb->wrap[n] = '\0';
+            *line = lb->wrap;
+        } else if (hoff + n < LB_CAP) {
+            *nl = '\0';
+            *line = lb->data + hoff;
+        } else {
+            lb_copy_out(lb, lb->wrap, lb->head, n);
+            lb->wrap[n] = '\0';
+            *line = lb->wrap;
+        }
+        *len = n;
+        lb->head = lb->scan = end + 1;
+        return 1;
+    }
+    if (lb->tail - lb->head >= LB_MAX_LINE - 1) {
+        // linha muito longa: entrega truncada e descarta o resto
+        size_t n = LB_MAX_LINE - 1;
+        lb_copy_out(lb, lb->wrap, lb->head, n);
+        lb->wrap[n] = '\0';
+        *line = lb->wrap;
+        *len = n;
+        lb->head = lb->scan = lb->tail;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Extrai o proximo quadro binario completo. *frame aponta para os tam
+ * bytes apos o prefixo; vale ate a proxima chamada sobre o buffer.
+ */
+static inline int lb_next_frame(linebuf_t *lb, const uint8_t **frame, size_t *len) {
+    size_t avail = lb->tail - lb->head;
+    if (avail < 1) return 0;
+    size_t n = (uint8_t)lb->data[lb->head & LB_MASK];
+    if (avail < 1 + n) return 0;
+    size_t off = (lb->head + 1) & LB_MASK;
+    if (off + n <= LB_CAP) {
+        *frame = (const uint8_t *)lb->data + off;
+    } else {
+        lb_copy_out(lb, lb->wrap, lb->head + 1, n);
+        *frame = (const uint8_t *)lb->wrap;
+    }
+    *len = n;
+    lb->head = lb->scan = lb->head + 1 + n;
+    return 1;
+}
+
+// Le do socket direto para o espaco livre do anel (ate dois segmentos).
+static inline ssize_t lb_fill(linebuf_t *lb, int fd) {
+    size_t room = LB_CAP - (lb->tail - lb->head);
+    size_t off = lb->tail & LB_MASK;
+    size_t first = LB_CAP - off < room ? LB_CAP - off : room;
+    struct iovec iov[2] = {
+        { lb->data + off, first },
+        { lb->data, room - first }
+    };
+    ssize_t r = readv(fd, iov, room > first ? 2 : 1);
+    if (r > 0) lb->tail += (size_t)r;
+    return r;
+}
+
+// Bloqueia ate ter uma linha completa. Retorna 0 se desconectou/erro.
+static inline int lb_recv_line(linebuf_t *lb, int fd, const char **line) {
+    size_t len;
+    while (!lb_next(lb, line, &len)) {
+        ssize_t r = lb_fill(lb, fd);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+    }
+    return 1;
+}
+
+// Bloqueia ate ter um quadro completo. Retorna 0 se desconectou/erro.
+static inline int lb_recv_frame(linebuf_t *lb, int fd, const uint8_t **frame, size_t *len) {
+    while (!lb_next_frame(lb, frame, len)) {
+        ssize_t r = lb_fill(lb, fd);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return 0;
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ * desafio3_protocolo.h - Mensagens do Jogo da Velha em texto e binario
+ *
+ * Toda mensagem e um msg_t (opcode + argumento). A tabela OPS descreve
+ * cada opcode e os codificadores/decodificadores sao escolhidos por
+ * tabela, sem cadeias de strcmp.
+ *
+ * Texto (padrao): uma linha por mensagem, ex. "BOARD X..O.....".
+ * Binario: [tam][opcode][argumento], tam = bytes apos o proprio tam.
+ *   SYM/COUNT/POS/ERR: 1 byte; BOARD: mascara X e mascara O (u16 LE);
+ *   ROOM/WATCH: numero da sala (u32 LE).
+ *
+ * Negociacao: o cliente envia "PROTO BIN" como primeira linha e passa a
+ * enviar binario. O servidor responde "PROTO BIN OK" (em texto) e dali
+ * em diante so envia binario. Clientes que nao enviam a linha seguem
+ * em texto.
+ */
+
+#ifndef DESAFIO3_PROTOCOLO_H
+#define DESAFIO3_PROTOCOLO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "desafio3_tabuleiro.h"
+#include "desafio3_linha.h"
+
+#define PROTO_TEXT 0
+#define PROTO_BIN  1
+
+#define PROTO_HELLO_BIN "PROTO BIN"
+#define PROTO_ACK_BIN   "PROTO BIN OK"
+
+#define MSG_MAX 64          // maior mensagem codificada (texto ou binario)
+
+enum {
+    // servidor -> cliente
+    OP_ASSIGN = 1, OP_WAITING, OP_START, OP_BOARD, OP_TURN, OP_OK_MOVE,
+    OP_ERR, OP_WIN, OP_DRAW, OP_OPP_LEFT, OP_BYE,
+    // cliente -> servidor
+    OP_MOVE, OP_END,
+    // salas e espectadores
+    OP_ROOM, OP_WATCH,
+    OP_COUNT
+};
+
+enum { ARG_NONE, ARG_SYM, ARG_COUNT, ARG_POS, ARG_ERR, ARG_BOARD, ARG_ID };
+
+enum {
+    ERR_NOT_STARTED, ERR_GAME_OVER, ERR_NOT_YOUR_TURN, ERR_BAD_POS,
+    ERR_OCCUPIED, ERR_BAD_CMD, ERR_UNKNOWN_CMD, ERR_ROOM_FULL,
+    ERR_SERVER_FULL, ERR_NO_ROOM, ERR_TIMEOUT,
+    ERR_COUNT
+};
+
+static const char *const ERR_TEXT[ERR_COUNT] = {
+    [ERR_NOT_STARTED]   = "Partida ainda nao iniciou",
+    [ERR_GAME_OVER]     = "Partida encerrada",
+    [ERR_NOT_YOUR_TURN] = "Nao eh sua vez",
+    [ERR_BAD_POS]       = "Posicao invalida",
+    [ERR_OCCUPIED]      = "Casa ocupada",
+    [ERR_BAD_CMD]       = "Comando invalido",
+    [ERR_UNKNOWN_CMD]   = "Comando desconhecido",
+    [ERR_ROOM_FULL]     = "Sala cheia",
+    [ERR_SERVER_FULL]   = "Servidor cheio",
+    [ERR_NO_ROOM]       = "Sala inexistente",
+    [ERR_TIMEOUT]       = "Tempo esgotado",
+};
+
+// Resultado da decodificacao
+#define MSG_OK       0
+#define MSG_UNKNOWN -1      // opcode/palavra-chave desconhecida
+#define MSG_BAD_ARG -2      // argumento malformado
+
+typedef struct {
+    uint8_t op;
+    uint8_t arg;            // simbolo, posicao, contagem ou codigo de erro
+    uint16_t marks[2];      // BOARD: mascaras de X e O
+    uint32_t id;            // ROOM/WATCH: numero da sala
+    const char *text;       // ERR recebido: descricao
+} msg_t;
+
+typedef struct {
+    const char *kw;
+    uint8_t kwlen;
+    uint8_t argt;
+} op_info_t;
+
+static const op_info_t OPS[OP_COUNT] = {
+    [OP_ASSIGN]   = { "ASSIGN",   6, ARG_SYM   },
+    [OP_WAITING]  = { "WAITING",  7, ARG_COUNT },
+    [OP_START]    = { "START",    5, ARG_NONE  },
+    [OP_BOARD]    = { "BOARD",    5, ARG_BOARD },
+    [OP_TURN]     = { "TURN",     4, ARG_SYM   },
+    [OP_OK_MOVE]  = { "OK MOVE",  7, ARG_POS   },
+    [OP_ERR]      = { "ERR",      3, ARG_ERR   },
+    [OP_WIN]      = { "WIN",      3, ARG_SYM   },
+    [OP_DRAW]     = { "DRAW",     4, ARG_NONE  },
+    [OP_OPP_LEFT] = { "OPP_LEFT", 8, ARG_NONE  },
+    [OP_BYE]      = { "BYE",      3, ARG_NONE  },
+    [OP_MOVE]     = { "MOVE",     4, ARG_POS   },
+    [OP_END]      = { "END",      3, ARG_NONE  },
+    [OP_ROOM]     = { "ROOM",     4, ARG_ID    },
+    [OP_WATCH]    = { "WATCH",    5, ARG_ID    },
+};
+
+/*
+ * Palavra-chave -> opcode sem percorrer OPS: o primeiro byte, o ultimo
+ * byte e o tamanho da primeira palavra da linha dao uma posicao unica
+ * por palavra-chave ("OK MOVE" entra por "OK"). So o candidato achado e
+ * conferido byte a byte.
+ */
+#define KW_HASH(c0, cl, n) ((unsigned)((c0) + (cl) + (n)) & 63)
+
+static const uint8_t KW_OPS[64] = {
+    [KW_HASH('A', 'N', 6)] = OP_ASSIGN,
+    [KW_HASH('W', 'G', 7)] = OP_WAITING,
+    [KW_HASH('S', 'T', 5)] = OP_START,
+    [KW_HASH('B', 'D', 5)] = OP_BOARD,
+    [KW_HASH('T', 'N', 4)] = OP_TURN,
+    [KW_HASH('O', 'K', 2)] = OP_OK_MOVE,
+    [KW_HASH('E', 'R', 3)] = OP_ERR,
+    [KW_HASH('W', 'N', 3)] = OP_WIN,
+    [KW_HASH('D', 'W', 4)] = OP_DRAW,
+    [KW_HASH('O', 'T', 8)] = OP_OPP_LEFT,
+    [KW_HASH('B', 'E', 3)] = OP_BYE,
+    [KW_HASH('M', 'E', 4)] = OP_MOVE,
+    [KW_HASH('E', 'D', 3)] = OP_END,
+    [KW_HASH('R', 'M', 4)] = OP_ROOM,
+    [KW_HASH('W', 'H', 5)] = OP_WATCH,
+};
+
+static const uint8_t ARG_BYTES[] = {
+    [ARG_NONE] = 0, [ARG_SYM] = 1, [ARG_COUNT] = 1,
+    [ARG_POS] = 1, [ARG_ERR] = 1, [ARG_BOARD] = 4, [ARG_ID] = 4
+};
+
+/* ---------------------------- codificacao ---------------------------- */
+
+static inline size_t put_uint(char *out, unsigned v) {
+    char tmp[10]; size_t n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    for (size_t i = 0; i < n; i++) out[i] = tmp[n - 1 - i];
+    return n;
+}
+
+static inline size_t msg_encode_text(const msg_t *m, uint8_t *buf) {
+    char *out = (char *)buf;
+    const op_info_t *info = &OPS[m->op];
+    size_t n = info->kwlen;
+    memcpy(out, info->kw, n);
+    switch (info->argt) {
+    case ARG_SYM:
+        out[n++] = ' '; out[n++] = (char)m->arg;
+        break;
+    case ARG_COUNT:
+        out[n++] = ' '; n += put_uint(out + n, m->arg);
+        out[n++] = '/'; out[n++] = '2';
+        break;
+    case ARG_POS:
+        out[n++] = ' '; n += put_uint(out + n, m->arg);
+        break;
+    case ARG_ERR: {
+        const char *t = m->arg < ERR_COUNT ? ERR_TEXT[m->arg] : "?";
+        size_t tl = strlen(t);
+        out[n++] = ' '; memcpy(out + n, t, tl); n += tl;
+        break;
+    }
+    case ARG_BOARD:
+        out[n++] = ' '; board_render(m->marks[0], m->marks[1], out + n);
+        n += BOARD_CELLS;
+        break;
+    case ARG_ID:
+        out[n++] = ' '; n += put_uint(out + n, m->id);
+        break;
+    }
+    out[n++] = '\n';
+    return n;
+}
+
+static inline size_t msg_encode_bin(const msg_t *m, uint8_t *out) {
+    uint8_t argt = OPS[m->op].argt;
+    out[0] = (uint8_t)(1 + ARG_BYTES[argt]);
+    out[1] = m->op;
+    if (argt == ARG_BOARD) {
+        out[2] = (uint8_t)m->marks[0]; out[3] = (uint8_t)(m->marks[0] >> 8);
+        out[4] = (uint8_t)m->marks[1]; out[5] = (uint8_t)(m->marks[1] >> 8);
+    } else if (argt == ARG_ID) {
+        out[2] = (uint8_t)m->id;         out[3] = (uint8_t)(m->id >> 8);
+        out[4] = (uint8_t)(m->id >> 16); out[5] = (uint8_t)(m->id >> 24);
+    } else if (argt != ARG_NONE) {
+        out[2] = m->arg;
+    }
+    return (size_t)out[0] + 1;
+}
+
+typedef size_t (*msg_encoder_t)(const msg_t *, uint8_t *);
+static const msg_encoder_t MSG_ENCODE[2] = {
+    [PROTO_TEXT] = msg_encode_text,
+    [PROTO_BIN]  = msg_encode_bin,
+};
+
+/* --------------------------- decodificacao --------------------------- */
+
+static inline int msg_decode_text(const char *line, msg_t *m) {
+    memset(m, 0, sizeof(*m));
+    size_t w = 0;
+    while (line[w] != ' ' && line[w] != '\0') w++;
+    if (w == 0) return MSG_UNKNOWN;
+    int op = KW_OPS[KW_HASH(line[0], line[w - 1], w)];
+    if (!op) return MSG_UNKNOWN;
+    const op_info_t *info = &OPS[op];
+    // so le line[kwlen] depois de confirmar que a linha tem a palavra-chave inteira
+    if (strncmp(line, info->kw, info->kwlen) != 0) return MSG_UNKNOWN;
+    char next = line[info->kwlen];
+    if (info->argt == ARG_NONE ? next != '\0' : next != ' ') return MSG_UNKNOWN;
+    m->op = (uint8_t)op;
+    const char *a = line + OPS[op].kwlen + 1;
+    switch (OPS[op].argt) {
+    case ARG_SYM:
+        m->arg = (uint8_t)a[0];
+        break;
+    case ARG_COUNT:
+        m->arg = (uint8_t)atoi(a);
+        break;
+    case ARG_POS: {
+        char *end = NULL;
+        long v = strtol(a, &end, 10);
+        if (end == a || *end != '\0') return MSG_BAD_ARG;
+        m->arg = (v < 0 || v > 255) ? 255 : (uint8_t)v;
+        break;
+    }
+    case ARG_ERR:
+        m->arg = ERR_COUNT;
+        m->text = a;
+        break;
+    case ARG_BOARD:
+        if (strlen(a) < BOARD_CELLS || board_parse(a, &m->marks[0], &m->marks[1]) != 0)
+            return MSG_BAD_ARG;
+        break;
+    case ARG_ID: {
+        char *end = NULL;
+        unsigned long v = strtoul(a, &end, 10);
+        if (end == a || *end != '\0' || v > 0xFFFFFFFFul) return MSG_BAD_ARG;
+        m->id = (uint32_t)v;
+        break;
+    }
+    }
+    return MSG_OK;
+}
+
+static inline int msg_decode_bin(const uint8_t *f, size_t len, msg_t *m) {
+    memset(m, 0, sizeof(*m));
+    if (len < 1 || f[0] == 0 || f[0] >= OP_COUNT) return MSG_UNKNOWN;
+    m->op = f[0];
+    uint8_t argt = OPS[m->op].argt;
+    if (len != 1u + ARG_BYTES[argt]) return MSG_BAD_ARG;
+    if (argt == ARG_BOARD) {
+        m->marks[0] = (uint16_t)((f[1] | (f[2] << 8)) & BOARD_MASK);
+        m->marks[1] = (uint16_t)((f[3] | (f[4] << 8)) & BOARD_MASK);
+    } else if (argt == ARG_ID) {
+        m->id = (uint32_t)f[1] | (uint32_t)f[2] << 8 | (uint32_t)f[3] << 16 | (uint32_t)f[4] << 24;
+    } else if (argt != ARG_NONE) {
+        m->arg = f[1];
+    }
+    if (argt == ARG_ERR) m->text = m->arg < ERR_COUNT ? ERR_TEXT[m->arg] : "?";
+    return MSG_OK;
+}
+
+/*
+ * Le e decodifica a proxima mensagem da conexao. Retorna 0 se a conexao
+ * caiu; caso contrario 1, com o resultado da decodificacao em *rc.
+ */
+static inline int msg_recv(linebuf_t *lb, int fd, int proto, msg_t *m, int *rc) {
+    if (proto == PROTO_BIN) {
+        const uint8_t *f; size_t len;
+        if (!lb_recv_frame(lb, fd, &f, &len)) return 0;
+        *rc = msg_decode_bin(f, len, m);
+    } else {
+        const char *line;
+        if (!lb_recv_line(lb, fd, &line)) return 0;
+        *rc = msg_decode_text(line, m);
+    }
+    return 1;
+}
+
+#endif
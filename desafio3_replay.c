@@ -0,0 +1,183 @@
+/*
+ * Reproducao do diario do Jogo da Velha
+ * Compilar: gcc -Wall -O2 desafio3_replay.c -o replay_velha
+ * Uso:      ./replay_velha [-t] <diario>
+ *           -t  imprime o tabuleiro final de cada sala
+ *
+ * Le o diario gravado pelo servidor (servidor_velha -j), refaz cada
+ * partida sobre o bitboard e imprime as estatisticas. O arquivo e
+ * mapeado em memoria e percorrido uma unica vez.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "desafio3_tabuleiro.h"
+#include "desafio3_diario.h"
+
+// Estado de uma sala durante a reproducao
+typedef struct {
+    uint16_t marks[2];
+    uint8_t moves;
+    uint8_t active;
+    uint8_t bot;
+} rstate_t;
+
+static const char *const RESULT_TEXT[JR_RESULTS] = {
+    [JR_WIN_X]   = "WIN X",
+    [JR_WIN_O]   = "WIN O",
+    [JR_DRAW]    = "DRAW",
+    [JR_ABANDON] = "OPP_LEFT",
+    [JR_TIMEOUT] = "TEMPO",
+};
+
+static rstate_t *rooms;
+static size_t rooms_cap;
+
+static rstate_t *room_at(uint32_t id) {
+    if (id >= rooms_cap) {
+        size_t cap = rooms_cap ? rooms_cap : 1024;
+        while (cap <= id) cap *= 2;
+        rstate_t *n = (rstate_t *)realloc(rooms, cap * sizeof(rstate_t));
+        if (!n) { perror("realloc"); exit(1); }
+        memset(n + rooms_cap, 0, (cap - rooms_cap) * sizeof(rstate_t));
+        rooms = n;
+        rooms_cap = cap;
+    }
+    return &rooms[id];
+}
+
+static void print_room(uint32_t id, const rstate_t *r, const char *status) {
+    char b[BOARD_CELLS + 1];
+    board_render(r->marks[0], r->marks[1], b);
+    printf("sala %u: %s %s%s\n", id, b, status, r->bot ? " (bot)" : "");
+}
+
+int main(int argc, char *argv[]) {
+    int show = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t")) != -1) {
+        if (opt == 't') show = 1;
+        else { printf("Uso: %s [-t] <diario>\n", argv[0]); return 1; }
+    }
+    if (argc - optind != 1) {
+        printf("Uso: %s [-t] <diario>\n", argv[0]);
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return 1; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat"); return 1; }
+    if ((size_t)st.st_size < sizeof(jheader_t)) { printf("Diario vazio ou truncado\n"); return 1; }
+
+    const uint8_t *map = (const uint8_t *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) { perror("mmap"); return 1; }
+    madvise((void *)map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const jheader_t *h = (const jheader_t *)map;
+    if (memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version < JOURNAL_VERSION_MIN || h->version > JOURNAL_VERSION || h->rec_size != sizeof(jrec_t)) {
+        printf("Formato de diario desconhecido: %s\n", path);
+        return 1;
+    }
+
+    board_init_tables();
+
+    size_t nrec = ((size_t)st.st_size - sizeof(jheader_t)) / sizeof(jrec_t);
+    const jrec_t *rec = (const jrec_t *)(map + sizeof(jheader_t));
+
+    uint64_t started = 0, bots = 0, moves = 0, finished_moves = 0, invalid = 0, mismatch = 0;
+    uint64_t results[JR_RESULTS] = { 0 };
+    uint64_t opening[BOARD_CELLS] = { 0 };
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (size_t i = 0; i < nrec; i++) {
+        const jrec_t *j = &rec[i];
+        rstate_t *r = room_at(j->room);
+        switch (j->type) {
+        case JR_START:
+            // o numero da sala recomeca se o servidor reiniciar
+            if (show && r->active) print_room(j->room, r, "INCOMPLETA");
+            memset(r, 0, sizeof(*r));
+            r->active = 1;
+            r->bot = j->a;
+            started++;
+            bots += j->a != 0;
+            break;
+        case JR_MOVE: {
+            if (!r->active || j->a > 1 || j->b >= BOARD_CELLS) { invalid++; break; }
+            uint16_t bit = (uint16_t)(1u << j->b);
+            if ((r->marks[0] | r->marks[1]) & bit) { invalid++; break; }
+            if (r->moves == 0) opening[j->b]++;
+            r->marks[j->a] |= bit;
+            r->moves++;
+            moves++;
+            break;
+        }
+        case JR_END:
+            if (!r->active || j->a >= JR_RESULTS) { invalid++; break; }
+            results[j->a]++;
+            finished_moves += r->moves;
+            // confere o resultado gravado com o tabuleiro reconstruido
+            if ((j->a == JR_WIN_X && !board_wins(r->marks[0])) ||
+                (j->a == JR_WIN_O && !board_wins(r->marks[1])) ||
+                (j->a == JR_DRAW && !board_full(r->marks[0], r->marks[1])))
+                mismatch++;
+            r->active = 0;
+            if (show) print_room(j->room, r, RESULT_TEXT[j->a]);
+            break;
+        default:
+            invalid++;
+        }
+    }
+
+    uint64_t incomplete = 0;
+    for (size_t id = 0; id < rooms_cap; id++) {
+        if (!rooms[id].active) continue;
+        incomplete++;
+        if (show) print_room((uint32_t)id, &rooms[id], "INCOMPLETA");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    uint64_t ended = results[JR_WIN_X] + results[JR_WIN_O] + results[JR_DRAW] + results[JR_ABANDON] +
+                     results[JR_TIMEOUT];
+    printf("Registros: %zu em %.3f s (%.1f milhoes/s)\n", nrec, secs,
+           secs > 0 ? (double)nrec / secs / 1e6 : 0.0);
+    if (nrec) {
+        double span = (double)(rec[nrec - 1].ts_ns - rec[0].ts_ns) / 1e9;
+        printf("Periodo do diario: %.1f s\n", span);
+    }
+    printf("Salas: %llu iniciadas (%llu com bot), %llu encerradas, %llu incompletas\n",
+           (unsigned long long)started, (unsigned long long)bots,
+           (unsigned long long)ended, (unsigned long long)incomplete);
+    printf("Resultados: X venceu %llu, O venceu %llu, empates %llu, abandonos %llu, tempo esgotado %llu\n",
+           (unsigned long long)results[JR_WIN_X], (unsigned long long)results[JR_WIN_O],
+           (unsigned long long)results[JR_DRAW], (unsigned long long)results[JR_ABANDON],
+           (unsigned long long)results[JR_TIMEOUT]);
+    printf("Jogadas: %llu (media %.2f por partida encerrada)\n", (unsigned long long)moves,
+           ended ? (double)finished_moves / (double)ended : 0.0);
+    printf("Primeira jogada:");
+    for (int i = 0; i < BOARD_CELLS; i++) printf(" %d=%llu", i, (unsigned long long)opening[i]);
+    printf("\n");
+    if (invalid || mismatch)
+        printf("Inconsistencias: %llu registros invalidos, %llu resultados divergentes\n",
+               (unsigned long long)invalid, (unsigned long long)mismatch);
+
+    munmap((void *)map, (size_t)st.st_size);
+    close(fd);
+    free(rooms);
+    return 0;
+}
@@ -1,325 +1,1407 @@
 /*
- * Servidor TCP - Jogo da Velha (2 jogadores)
+ * Servidor TCP - Jogo da Velha (salas de 2 jogadores)
  * Compilar: gcc -Wall -lpthread desafio3_servidor.c -o servidor_velha
- * Uso:      ./servidor_velha [porta]  (padrão: 5000)
+ * Uso:      ./servidor_velha [-a aceitadores] [-l backlog] [-e porta_espectadores]
+ *                          [-b espera_bot_ms] [-j diario] [-t prazo_jogada_ms]
+ *                          [-i prazo_ocioso_ms] [-m socket_metricas] [porta]  (padrão: 5000)
+ *
+ * Cada thread aceitadora tem seu proprio socket de escuta na mesma porta
+ * (SO_REUSEPORT), e o kernel distribui as conexoes entre elas. Cada
+ * conexao aceita entra numa fila de matchmaking sem travas. Uma
+ * thread de pareamento retira as conexoes em lotes e cria uma sala nova
+ * para cada par; cada sala tem seu proprio mutex. Com -b, quem espera
+ * sozinho por mais de N ms ganha um bot como oponente (joga de O).
+ *
+ * Espectadores conectam na porta de espectadores (-e, padrão porta+1) e
+ * enviam "WATCH <sala>". Cada evento da sala e codificado uma unica vez
+ * num buffer com contagem de referencias, e a thread de espectadores
+ * (epoll) enfileira o mesmo buffer para todos os inscritos.
+ *
+ * Com -j, inicio de sala, jogadas aceitas e resultado sao gravados num
+ * diario binario (ver desafio3_diario.h e desafio3_replay.c).
+ *
+ * Prazos (roda de temporizadores com tick na thread de espectadores):
+ * quem nao joga em -t ms perde a partida; quem fica sem par, espectador
+ * que nao envia WATCH e jogador que nao sai depois do fim sao
+ * desconectados apos -i ms.
+ *
+ * Com -m, contadores de conexoes, salas, comandos, erros e disputa das
+ * travas de sala sao servidos no socket Unix indicado (ver metricas.h).
  */
 
+#define _GNU_SOURCE     // accept4
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include<stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
 
+#include "desafio3_protocolo.h"
+#include "desafio3_fila.h"
+#include "desafio3_bot.h"
+#include "desafio3_diario.h"
+#include "desafio3_temporizador.h"
+#include "metricas.h"
 
-#define QUEUE_LENGTH 5
-#define MAX_FLOW_SIZE 1024
+
+#define DEFAULT_BACKLOG 4096     // limitado pelo kernel a net.core.somaxconn
 #define DEFAULT_PORT 5000
+#define MAX_ACCEPTORS 64
 
-typedef struct {
-    int clients[2];      // fds dos clientes; -1 se vazio
-    char symbols[2];     // 'X' ou 'O'
+#define MATCH_QUEUE_CAP  65536   // conexoes aguardando par (potencia de 2)
+#define MATCH_BATCH      256     // conexoes retiradas da fila por rodada
+#define REPORT_SEC       5       // intervalo dos relatorios periodicos
+
+#define ROOM_BUCKETS     4096    // tabela de salas por numero
+#define EVENT_QUEUE_CAP  65536   // eventos de sala a caminho dos espectadores
+#define SPEC_QUEUE       256     // eventos pendentes por espectador (potencia de 2)
+#define SPEC_BUCKETS     4096    // espectadores por sala (tabela da thread de espectadores)
+
+#define JOURNAL_RING     65536   // registros aguardando gravacao (potencia de 2)
+#define JOURNAL_BATCH    4096    // maximo de registros por write/fdatasync
+
+#define TIMER_TICK_MS    100     // resolucao da roda de temporizadores
+#define DEFAULT_TURN_MS  30000   // prazo de cada jogada
+#define DEFAULT_IDLE_MS  60000   // conexao parada sem motivo (fila, fim de jogo, espectador)
+
+typedef struct room {
+    uint32_t id;
+    pthread_mutex_t mut;
+    int clients[2];      // fds dos clientes; -1 se saiu
+    int proto[2];        // PROTO_TEXT ou PROTO_BIN, por cliente
     int count;           // conectados
-    int current;         // índice do jogador da vez (0 ou 1)
-    char board[9];       // '.', 'X', 'O'
+    int current;         // índice do jogador da vez (0 = X, 1 = O)
+    uint16_t marks[2];   // bitboard de cada jogador: bit i = casa i ocupada
     int started;         // 1 quando dois conectados
     int game_over;       // 1 quando terminou
-} game_t;
-
-static game_t game;
-static pthread_mutex_t gmut = PTHREAD_MUTEX_INITIALIZER;
-
-static void send_line(int fd, const char *fmt, ...) {
-    char out[MAX_FLOW_SIZE];
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(out, sizeof(out), fmt, ap);
-    va_end(ap);
-    size_t len = strnlen(out, sizeof(out));
-    // garante \n no final
-    if (len == 0 || out[len-1] != '\n') {
-        if (len + 1 < sizeof(out)) {
-            out[len] = '\n';
-            out[len+1] = '\0';
-            len++;
+    int bot_slot;        // assento ocupado pelo bot; -1 se nao ha bot
+    int refs;            // threads de cliente ainda usando a sala
+    _Atomic int watchers;  // espectadores inscritos
+    uint64_t events;     // eventos difundidos; numera os publicados aos espectadores
+    uint64_t deadline;   // ms monotonicos: fim da vez, ou do prazo apos o fim do jogo
+    tnode_t timer;       // na roda enquanto a sala existir (segura uma ref)
+    struct room *next;   // encadeamento em room_tab
+} room_t;
+
+// Conexao na fila de matchmaking
+typedef struct {
+    int fd;
+    struct timespec since;
+} waiting_t;
+
+// Metricas (mesma ordem de MET_DEFS); comandos recebidos por tipo
+enum { CMD_UNKNOWN, CMD_BAD, CMD_MOVE, CMD_END, CMD_PROTO, CMD_KINDS };
+
+static const char *const CMD_NAMES[CMD_KINDS] = {
+    [CMD_UNKNOWN] = "desconhecido", [CMD_BAD] = "invalido",
+    [CMD_MOVE] = "MOVE", [CMD_END] = "END", [CMD_PROTO] = PROTO_HELLO_BIN,
+};
+
+static const uint8_t CMD_KIND[OP_COUNT] = { [OP_MOVE] = CMD_MOVE, [OP_END] = CMD_END };
+
+enum {
+    M_ACCEPTED, M_REFUSED, M_ACCEPT_ERRORS, M_PLAYERS, M_SPECTATORS,
+    M_ROOMS, M_ROOMS_BOT, M_ROOMS_ACTIVE,
+    M_CMD, M_ERR = M_CMD + CMD_KINDS,
+    M_LOCKS = M_ERR + ERR_COUNT, M_LOCK_CONTENDED, M_LOCK_WAIT,
+    M_SLOW_DROPS,
+    M_COUNT
+};
+
+static const met_def_t MET_DEFS[] = {
+    { .name = "velha_conexoes_aceitas_total", .help = "Conexoes de jogadores aceitas", .type = MET_COUNTER },
+    { .name = "velha_conexoes_recusadas_total", .help = "Conexoes recusadas com a fila de matchmaking cheia",
+      .type = MET_COUNTER },
+    { .name = "velha_erros_accept_total", .help = "Falhas de accept (EMFILE, ENFILE, ...)", .type = MET_COUNTER },
+    { .name = "velha_jogadores_conectados", .help = "Jogadores conectados (na fila ou em sala)", .type = MET_GAUGE },
+    { .name = "velha_espectadores_conectados", .help = "Conexoes de espectadores abertas", .type = MET_GAUGE },
+    { .name = "velha_salas_total", .help = "Salas criadas", .type = MET_COUNTER },
+    { .name = "velha_salas_bot_total", .help = "Salas criadas com bot", .type = MET_COUNTER },
+    { .name = "velha_salas_ativas", .help = "Salas ainda em memoria", .type = MET_GAUGE },
+    { .name = "velha_comandos_total", .help = "Comandos recebidos dos jogadores", .type = MET_COUNTER,
+      .label = "tipo", .values = CMD_NAMES, .n = CMD_KINDS },
+    { .name = "velha_erros_enviados_total", .help = "Mensagens ERR enviadas", .type = MET_COUNTER,
+      .label = "motivo", .values = ERR_TEXT, .n = ERR_COUNT },
+    { .name = "velha_trava_sala_total", .help = "Aquisicoes do mutex de sala", .type = MET_COUNTER },
+    { .name = "velha_trava_sala_disputada_total", .help = "Aquisicoes do mutex de sala que tiveram de esperar",
+      .type = MET_COUNTER },
+    { .name = "velha_trava_sala_espera_segundos_total", .help = "Tempo total esperando o mutex de sala",
+      .type = MET_COUNTER, .scale = 1e-9 },
+    { .name = "velha_jogadores_lentos_total", .help = "Jogadores desconectados com o buffer de envio cheio",
+      .type = MET_COUNTER },
+};
+
+static mpmc_t match_q;
+static sem_t match_ready;                 // um post por conexao enfileirada
+static _Atomic uint32_t next_room_id = 1;
+static int bot_wait_ms = 0;               // 0: sem bot
+static int turn_ms = DEFAULT_TURN_MS;
+static int idle_ms = DEFAULT_IDLE_MS;
+
+// Prazos de salas e espectadores; a thread de espectadores faz o tick
+static pthread_mutex_t timer_mut = PTHREAD_MUTEX_INITIALIZER;
+static twheel_t timers;
+static int spec_tfd = -1;                 // timerfd do tick
+
+// Salas ativas por numero, para inscricao de espectadores
+static struct {
+    pthread_mutex_t mut;
+    room_t *head;
+} room_tab[ROOM_BUCKETS];
+
+// Evento codificado uma unica vez e compartilhado pelas filas de saida
+// de todos os espectadores da sala. So a thread de espectadores mexe em
+// refs depois que o evento e publicado.
+typedef struct {
+    int refs;
+    uint32_t room;
+    uint64_t seq;       // numero do evento na sala (0: so para um espectador)
+    uint8_t op;
+    uint16_t len;
+    uint8_t data[MSG_MAX];
+} msgbuf_t;
+
+static mpmc_t event_q;                    // msgbuf_t* publicados pelas salas
+static int spec_efd = -1;                 // eventfd que acorda a thread de espectadores
+static _Atomic int spec_wake;             // 1 se ja ha um aviso pendente no eventfd
+
+static double elapsed_ms(const struct timespec *a, const struct timespec *b) {
+    return (double)(b->tv_sec - a->tv_sec) * 1e3 + (double)(b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+/*
+ * Trava a sala. O relogio so e lido quando o trylock falha, entao o caso
+ * sem disputa custa o mesmo que antes mais um incremento.
+ */
+static void room_lock(room_t *r) {
+    met_add(M_LOCKS, 1);
+    if (pthread_mutex_trylock(&r->mut) == 0) return;
+    struct timespec a, b;
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    pthread_mutex_lock(&r->mut);
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    met_add(M_LOCK_CONTENDED, 1);
+    met_add(M_LOCK_WAIT, (int64_t)(b.tv_sec - a.tv_sec) * 1000000000 + (b.tv_nsec - a.tv_nsec));
+}
+
+// Fecha a conexao de um jogador (na fila ou em sala)
+static void close_player(int fd) {
+    close(fd);
+    met_add(M_PLAYERS, -1);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Tick em que o prazo (ms) ja passou
+static uint64_t ms_to_tick(uint64_t ms) {
+    return (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+}
+
+static void timer_arm(tnode_t *t, uint64_t deadline_ms) {
+    pthread_mutex_lock(&timer_mut);
+    tw_add(&timers, t, ms_to_tick(deadline_ms));
+    pthread_mutex_unlock(&timer_mut);
+}
+
+static void timer_cancel(tnode_t *t) {
+    pthread_mutex_lock(&timer_mut);
+    tw_del(&timers, t);
+    pthread_mutex_unlock(&timer_mut);
+}
+
+/* -------------------------------- diario -------------------------------- */
+
+/*
+ * As threads de sala so gravam o registro numa fila em memoria (sem
+ * syscall: clock_gettime e vDSO); a thread do diario esvazia a fila em
+ * lotes, com um write e um fdatasync por lote. Sem registros, a thread
+ * dorme no eventfd; como nos espectadores, so o produtor que encontra a
+ * thread parada escreve nele.
+ */
+
+MPMC_DEFINE(jqueue, jrec_t)
+
+static jqueue_t journal_q;
+static _Alignas(64) _Atomic uint64_t jdropped;   // fila cheia ou falha de escrita
+static _Alignas(64) _Atomic int journal_wake = 1; // 0: thread do diario parada
+static int journal_fd = -1;
+static int journal_efd = -1;
+static off_t journal_size;                        // so a thread do diario escreve
+
+static int journal_open(const char *path) {
+    journal_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (journal_fd < 0) { perror(path); return -1; }
+    struct stat st;
+    if (fstat(journal_fd, &st) < 0) { perror("fstat"); return -1; }
+    journal_size = st.st_size;
+    if (journal_size == 0) {
+        jheader_t h;
+        memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+        h.version = JOURNAL_VERSION;
+        h.rec_size = sizeof(jrec_t);
+        if (write(journal_fd, &h, sizeof(h)) != (ssize_t)sizeof(h)) { perror("write"); return -1; }
+        journal_size = sizeof(h);
+    } else {
+        // so acrescenta a um diario no mesmo formato (como o replay confere)
+        jheader_t h;
+        if (pread(journal_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+            memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) != 0 ||
+            h.version != JOURNAL_VERSION || h.rec_size != sizeof(jrec_t)) {
+            fprintf(stderr, "%s: nao e um diario no formato versao %d\n", path, JOURNAL_VERSION);
+            return -1;
         }
     }
-    send(fd, out, len, 0);
+    if ((journal_size - (off_t)sizeof(jheader_t)) % (off_t)sizeof(jrec_t) != 0) {
+        // registro incompleto de uma execucao anterior: o replay le registros inteiros
+        journal_size -= (journal_size - (off_t)sizeof(jheader_t)) % (off_t)sizeof(jrec_t);
+        if (ftruncate(journal_fd, journal_size) < 0) { perror("ftruncate"); return -1; }
+    }
+    journal_efd = eventfd(0, EFD_CLOEXEC);
+    if (journal_efd < 0) { perror("eventfd"); return -1; }
+    if (jqueue_init(&journal_q, JOURNAL_RING) < 0) { perror("malloc"); return -1; }
+    return 0;
+}
+
+static void journal_log(uint32_t room, uint8_t type, uint8_t a, uint8_t b) {
+    if (journal_fd < 0) return;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    jrec_t rec = {
+        .ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec,
+        .room = room, .type = type, .a = a, .b = b,
+    };
+    if (jqueue_push(&journal_q, rec) < 0) {
+        atomic_fetch_add_explicit(&jdropped, 1, memory_order_relaxed);
+        return;
+    }
+    // par do fence em journal_thread: ou a thread ve o registro, ou nos a vemos parada
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&journal_wake, memory_order_relaxed) && !atomic_exchange(&journal_wake, 1)) {
+        uint64_t one = 1;
+        if (write(journal_efd, &one, sizeof(one)) < 0) { /* contador do eventfd saturado */ }
+    }
+}
+
+static size_t journal_drain(jrec_t *buf) {
+    size_t n = 0;
+    while (n < JOURNAL_BATCH && jqueue_pop(&journal_q, &buf[n]) == 0) n++;
+    return n;
 }
 
-static void bcast(const char *fmt, ...) {
-    char out[MAX_FLOW_SIZE];
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(out, sizeof(out), fmt, ap);
-    va_end(ap);
-    size_t len = strnlen(out, sizeof(out));
-    if (len == 0 || out[len-1] != '\n') {
-        if (len + 1 < sizeof(out)) {
-            out[len] = '\n'; out[len+1] = '\0'; len++;
+/*
+ * Grava o lote. Se write falhar no meio, o arquivo volta ao ultimo
+ * registro inteiro (o replay le registros de tamanho fixo) e o que nao
+ * foi gravado conta como descartado. Retorna os registros gravados.
+ */
+static size_t journal_write(const jrec_t *buf, size_t n) {
+    const char *p = (const char *)buf;
+    size_t left = n * sizeof(jrec_t);
+    while (left) {
+        ssize_t w = write(journal_fd, p, left);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("diario: write");
+            break;
         }
+        p += w;
+        left -= (size_t)w;
     }
-    for (int i = 0; i < 2; i++) {
-        if (game.clients[i] != -1) send(game.clients[i], out, len, 0);
+    size_t done = (n * sizeof(jrec_t) - left) / sizeof(jrec_t);
+    journal_size += (off_t)(done * sizeof(jrec_t));
+    if (left && ftruncate(journal_fd, journal_size) < 0) perror("diario: ftruncate");
+    if (done < n) atomic_fetch_add_explicit(&jdropped, n - done, memory_order_relaxed);
+    return done;
+}
+
+static void *journal_thread(void *arg) {
+    (void)arg;
+    jrec_t *buf = (jrec_t *)malloc(JOURNAL_BATCH * sizeof(jrec_t));
+    if (!buf) { perror("malloc"); return NULL; }
+    uint64_t recs = 0, batches = 0;
+    struct timespec last_report;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+
+    while (1) {
+        size_t n = journal_drain(buf);
+        if (!n) {
+            // anuncia que vai dormir e confere a fila mais uma vez antes
+            atomic_store(&journal_wake, 0);
+            atomic_thread_fence(memory_order_seq_cst);
+            n = journal_drain(buf);
+            if (!n) {
+                uint64_t cnt;
+                if (read(journal_efd, &cnt, sizeof(cnt)) < 0 && errno != EINTR) perror("diario: read");
+            }
+            atomic_store(&journal_wake, 1);
+        }
+
+        if (n) {
+            // tudo o que chegou durante o fdatasync anterior vai neste lote
+            size_t done = journal_write(buf, n);
+            if (done) {
+                fdatasync(journal_fd);
+                recs += done;
+                batches++;
+            }
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (recs && elapsed_ms(&last_report, &now) >= REPORT_SEC * 1e3) {
+            printf("Diario: registros=%llu lotes=%llu (%.1f por fdatasync) descartados=%llu\n",
+                   (unsigned long long)recs, (unsigned long long)batches,
+                   (double)recs / (double)batches,
+                   (unsigned long long)atomic_load_explicit(&jdropped, memory_order_relaxed));
+            fflush(stdout);
+            recs = 0; batches = 0;
+            last_report = now;
+        }
     }
+    return NULL;
 }
 
-static void board_to_str(char *buf, size_t n) {
-    for (int i = 0; i < 9 && i < (int)(n-1); i++) buf[i] = game.board[i];
-    buf[9 < (int)(n-1) ? 9 : (int)(n-1)] = '\0';
+static void room_register(room_t *r) {
+    unsigned b = r->id % ROOM_BUCKETS;
+    pthread_mutex_lock(&room_tab[b].mut);
+    r->next = room_tab[b].head;
+    room_tab[b].head = r;
+    pthread_mutex_unlock(&room_tab[b].mut);
 }
 
-static int check_winner(char sym) {
-    const int L[8][3] = {
-        {0,1,2},{3,4,5},{6,7,8},  // linhas
-        {0,3,6},{1,4,7},{2,5,8},  // colunas
-        {0,4,8},{2,4,6}           // diagonais
-    };
-    for (int i = 0; i < 8; i++) {
-        if (game.board[L[i][0]] == sym &&
-            game.board[L[i][1]] == sym &&
-            game.board[L[i][2]] == sym) return 1;
+static void room_unregister(room_t *r) {
+    unsigned b = r->id % ROOM_BUCKETS;
+    pthread_mutex_lock(&room_tab[b].mut);
+    for (room_t **pp = &room_tab[b].head; *pp; pp = &(*pp)->next) {
+        if (*pp == r) { *pp = r->next; break; }
     }
-    return 0;
+    pthread_mutex_unlock(&room_tab[b].mut);
+}
+
+// Publica o evento para os espectadores da sala (chamado com r->mut travado).
+static void publish_locked(room_t *r, const msg_t *m) {
+    uint64_t seq = ++r->events;
+    if (!atomic_load_explicit(&r->watchers, memory_order_relaxed)) return;
+    msgbuf_t *b = (msgbuf_t *)malloc(sizeof(msgbuf_t));
+    if (!b) return;
+    b->refs = 0;
+    b->room = r->id;
+    b->seq = seq;
+    b->op = m->op;
+    b->len = (uint16_t)msg_encode_text(m, b->data);
+    if (mpmc_push(&event_q, b) < 0) { free(b); return; }
+    if (!atomic_exchange(&spec_wake, 1)) {
+        uint64_t one = 1;
+        if (write(spec_efd, &one, sizeof(one)) < 0) { /* contador do eventfd saturado */ }
+    }
+}
+
+/*
+ * Envio para jogador sem bloquear: os envios acontecem com o mutex da
+ * sala travado (inclusive na thread de espectadores e temporizadores), e
+ * quem nao le ate encher o buffer do socket e desconectado. shutdown (e
+ * nao close) acorda a thread do cliente, que fecha o fd.
+ */
+static void player_send(int fd, const void *buf, size_t len) {
+    ssize_t w;
+    do {
+        w = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } while (w < 0 && errno == EINTR);
+    if (w == (ssize_t)len) return;
+    if (w >= 0 || errno == EAGAIN || errno == EWOULDBLOCK) met_add(M_SLOW_DROPS, 1);
+    shutdown(fd, SHUT_RDWR);
+}
+
+static void send_msg(int fd, int proto, const msg_t *m) {
+    if (m->op == OP_ERR && m->arg < ERR_COUNT) met_add(M_ERR + m->arg, 1);
+    uint8_t out[MSG_MAX];
+    size_t len = MSG_ENCODE[proto](m, out);
+    player_send(fd, out, len);
+}
+
+// Codifica no maximo uma vez por protocolo e envia aos dois jogadores.
+static void bcast_msg(room_t *r, const msg_t *m) {
+    uint8_t out[2][MSG_MAX];
+    size_t len[2] = { 0, 0 };
+    for (int i = 0; i < 2; i++) {
+        if (r->clients[i] == -1) continue;
+        int p = r->proto[i];
+        if (!len[p]) len[p] = MSG_ENCODE[p](m, out[p]);
+        player_send(r->clients[i], out[p], len[p]);
+    }
+    publish_locked(r, m);
+}
+
+static void send_op(room_t *r, int slot, uint8_t op, uint8_t arg) {
+    msg_t m = { .op = op, .arg = arg };
+    send_msg(r->clients[slot], r->proto[slot], &m);
+}
+
+static void bcast_op(room_t *r, uint8_t op, uint8_t arg) {
+    msg_t m = { .op = op, .arg = arg };
+    bcast_msg(r, &m);
 }
 
-static int board_full(void) {
-    for (int i = 0; i < 9; i++) if (game.board[i] == '.') return 0;
-    return 1;
+static msg_t board_msg(const room_t *r) {
+    msg_t m = { .op = OP_BOARD, .marks = { r->marks[0], r->marks[1] } };
+    return m;
 }
 
-static void start_game_if_ready(void) {
-    if (game.count == 2 && !game.started) {
-        game.started = 1;
-        game.current = 0; // X começa
-        char b[16]; board_to_str(b, sizeof(b));
-        bcast("START");
-        bcast("BOARD %s", b);
-        bcast("TURN %c", game.symbols[game.current]);
+// Estado completo para um cliente (entrada na sala ou troca de protocolo)
+static void send_state_locked(room_t *r, int slot) {
+    msg_t room = { .op = OP_ROOM, .id = r->id };
+    send_op(r, slot, OP_ASSIGN, (uint8_t)BOARD_SYMBOLS[slot]);
+    send_msg(r->clients[slot], r->proto[slot], &room);
+    send_op(r, slot, OP_WAITING, (uint8_t)r->count);
+    if (r->started) {
+        msg_t b = board_msg(r);
+        send_op(r, slot, OP_START, 0);
+        send_msg(r->clients[slot], r->proto[slot], &b);
+        send_op(r, slot, OP_TURN, (uint8_t)BOARD_SYMBOLS[r->current]);
     }
 }
 
 typedef struct {
+    room_t *room;
     int slot; // 0 ou 1
 } client_arg_t;
 
-static int safe_parse_int(const char *s, int *out) {
-    char *end = NULL;
-    long v = strtol(s, &end, 10);
-    if (end == s || *end != '\0') return -1;
-    if (v < -2147483648L || v > 2147483647L) return -1;
-    *out = (int)v;
-    return 0;
+// Aplica uma jogada ja validada e difunde o resultado.
+static void apply_move_locked(room_t *r, int slot, int pos) {
+    uint16_t bit = (uint16_t)(1u << pos);
+    char sym = BOARD_SYMBOLS[slot];
+    r->marks[slot] |= bit;
+    journal_log(r->id, JR_MOVE, (uint8_t)slot, (uint8_t)pos);
+
+    msg_t b = board_msg(r);
+    bcast_op(r, OP_OK_MOVE, (uint8_t)pos);
+    bcast_msg(r, &b);
+
+    if (board_wins(r->marks[slot])) {
+        r->game_over = 1;
+        r->deadline = now_ms() + idle_ms;
+        journal_log(r->id, JR_END, slot == 0 ? JR_WIN_X : JR_WIN_O, 0);
+        bcast_op(r, OP_WIN, (uint8_t)sym);
+        bcast_op(r, OP_BYE, 0);
+        return;
+    }
+    if (board_full(r->marks[0], r->marks[1])) {
+        r->game_over = 1;
+        r->deadline = now_ms() + idle_ms;
+        journal_log(r->id, JR_END, JR_DRAW, 0);
+        bcast_op(r, OP_DRAW, 0);
+        bcast_op(r, OP_BYE, 0);
+        return;
+    }
+    r->current = 1 - r->current;
+    r->deadline = now_ms() + turn_ms;   // o temporizador confere ao vencer o prazo antigo
+    bcast_op(r, OP_TURN, (uint8_t)BOARD_SYMBOLS[r->current]);
 }
 
-static void handle_move_locked(int slot, int pos) {
-    if (!game.started) { send_line(game.clients[slot], "ERR Partida ainda nao iniciou"); return; }
-    if (game.game_over) { send_line(game.clients[slot], "ERR Partida encerrada"); return; }
-    if (slot != game.current) { send_line(game.clients[slot], "ERR Nao eh sua vez"); return; }
-    if (pos < 0 || pos > 8) { send_line(game.clients[slot], "ERR Posicao invalida"); return; }
-    if (game.board[pos] != '.') { send_line(game.clients[slot], "ERR Casa ocupada"); return; }
+static void handle_move_locked(room_t *r, int slot, int pos) {
+    if (!r->started) { send_op(r, slot, OP_ERR, ERR_NOT_STARTED); return; }
+    if (r->game_over) { send_op(r, slot, OP_ERR, ERR_GAME_OVER); return; }
+    if (slot != r->current) { send_op(r, slot, OP_ERR, ERR_NOT_YOUR_TURN); return; }
+    if ((unsigned)pos >= BOARD_CELLS) { send_op(r, slot, OP_ERR, ERR_BAD_POS); return; }
+    uint16_t bit = (uint16_t)(1u << pos);
+    if ((r->marks[0] | r->marks[1]) & bit) { send_op(r, slot, OP_ERR, ERR_OCCUPIED); return; }
+
+    apply_move_locked(r, slot, pos);
+    // o bot responde na hora, com uma consulta a tabela
+    if (!r->game_over && r->current == r->bot_slot)
+        apply_move_locked(r, r->bot_slot, bot_pick(r->marks[0], r->marks[1]));
+}
+
+static void leave_locked(room_t *r, int slot) {
+    int fd = r->clients[slot];
+    r->clients[slot] = -1;
+    if (!r->game_over) {
+        r->game_over = 1;
+        r->deadline = now_ms() + idle_ms;
+        journal_log(r->id, JR_END, JR_ABANDON, (uint8_t)slot);
+        bcast_op(r, OP_OPP_LEFT, 0);
+        bcast_op(r, OP_BYE, 0);
+    }
+    if (fd != -1) close_player(fd);
+}
+
+/*
+ * A ultima thread a sair libera a sala. Se so sobrou a referencia do
+ * temporizador, ele e cancelado e a sala sai na hora, sem esperar o
+ * prazo. Se o temporizador ja saiu da roda para disparar, o disparo
+ * encontra a sala vazia e a libera.
+ */
+static void room_release(room_t *r) {
+    room_lock(r);
+    int last = --r->refs == 0;
+    if (r->refs == 1) {
+        pthread_mutex_lock(&timer_mut);
+        if (tw_pending(&r->timer)) {
+            tw_del(&timers, &r->timer);
+            r->refs = 0;
+            last = 1;
+        }
+        pthread_mutex_unlock(&timer_mut);
+    }
+    pthread_mutex_unlock(&r->mut);
+    if (last) {
+        met_add(M_ROOMS_ACTIVE, -1);
+        room_unregister(r);
+        pthread_mutex_destroy(&r->mut);
+        free(r);
+    }
+}
 
-    char sym = game.symbols[slot];
-    game.board[pos] = sym;
+static uint64_t turn_timeouts, idle_reaped;   // so a thread de espectadores escreve
 
-    char b[16]; board_to_str(b, sizeof(b));
-    bcast("OK MOVE %d", pos);
-    bcast("BOARD %s", b);
+/*
+ * Temporizador da sala, disparado pela thread de espectadores. As jogadas
+ * so adiantam r->deadline; o no continua no prazo antigo e e rearmado
+ * aqui, sem mexer na roda a cada jogada. Vencida a vez, quem devia jogar
+ * perde; vencido o prazo depois do fim, quem ficou conectado e
+ * desconectado. shutdown (e nao close) acorda a thread do cliente, que
+ * fecha o fd como em qualquer desconexao.
+ */
+static void room_timer_fire(tnode_t *t) {
+    room_t *r = (room_t *)((char *)t - offsetof(room_t, timer));
+    uint64_t now = now_ms();
+    // o laco de eventos nao espera pela sala: ocupada, tenta no proximo tick
+    if (pthread_mutex_trylock(&r->mut) != 0) {
+        timer_arm(t, now + TIMER_TICK_MS);
+        return;
+    }
+    int gone = 1;
+    for (int i = 0; i < 2; i++)
+        if (i != r->bot_slot && r->clients[i] != -1) gone = 0;
 
-    if (check_winner(sym)) {
-        game.game_over = 1;
-        bcast("WIN %c", sym);
-        bcast("BYE");
+    if (!(r->game_over && gone) && r->deadline > now) {
+        timer_arm(t, r->deadline);
+        pthread_mutex_unlock(&r->mut);
         return;
     }
-    if (board_full()) {
-        game.game_over = 1;
-        bcast("DRAW");
-        bcast("BYE");
+    if (!r->game_over) {
+        int slot = r->current;
+        r->game_over = 1;
+        r->deadline = now + idle_ms;
+        turn_timeouts++;
+        journal_log(r->id, JR_END, JR_TIMEOUT, (uint8_t)slot);
+        send_op(r, slot, OP_ERR, ERR_TIMEOUT);
+        bcast_op(r, OP_WIN, (uint8_t)BOARD_SYMBOLS[1 - slot]);
+        bcast_op(r, OP_BYE, 0);
+        shutdown(r->clients[slot], SHUT_RDWR);
+        timer_arm(t, r->deadline);
+        pthread_mutex_unlock(&r->mut);
         return;
     }
-    game.current = 1 - game.current;
-    bcast("TURN %c", game.symbols[game.current]);
+    for (int i = 0; i < 2; i++) {
+        if (i == r->bot_slot || r->clients[i] == -1) continue;
+        shutdown(r->clients[i], SHUT_RDWR);
+        idle_reaped++;
+    }
+    pthread_mutex_unlock(&r->mut);
+    room_release(r);    // ref do temporizador
 }
 
-static int recv_line(int fd, char *buf, size_t n, char *carry, size_t *carry_len) {
-    // Usa carry como buffer acumulado até '\n'
-    size_t len = *carry_len;
-    memcpy(buf, carry, len);
+/*
+ * Tratadores de comando indexados por opcode. Retornam 1 quando o
+ * cliente deve ser encerrado. Chamados com o mutex da sala travado.
+ */
+typedef int (*cmd_handler_t)(room_t *r, int slot, const msg_t *m);
+
+static int cmd_move(room_t *r, int slot, const msg_t *m) { handle_move_locked(r, slot, m->arg); return 0; }
+static int cmd_end(room_t *r, int slot, const msg_t *m) { (void)m; leave_locked(r, slot); return 1; }
+
+static const cmd_handler_t CMD_HANDLERS[OP_COUNT] = {
+    [OP_MOVE] = cmd_move,
+    [OP_END]  = cmd_end,
+};
+
+static void *client_thread(void *arg) {
+    client_arg_t info = *(client_arg_t *)arg;
+    free(arg);
+    room_t *r = info.room;
+    int slot = info.slot;
+    int fd = r->clients[slot];
+
+    linebuf_t lb; lb_init(&lb);
+
+    // Primeira linha pode negociar o protocolo binario
+    const char *line;
+    if (!lb_recv_line(&lb, fd, &line)) {
+        room_lock(r);
+        leave_locked(r, slot);
+        pthread_mutex_unlock(&r->mut);
+        room_release(r);
+        return NULL;
+    }
+    int pending = 1;    // primeira linha ainda nao tratada como comando
+    if (strcmp(line, PROTO_HELLO_BIN) == 0) {
+        met_add(M_CMD + CMD_PROTO, 1);
+        room_lock(r);
+        player_send(fd, PROTO_ACK_BIN "\n", sizeof(PROTO_ACK_BIN));
+        r->proto[slot] = PROTO_BIN;
+        send_state_locked(r, slot);
+        pthread_mutex_unlock(&r->mut);
+        pending = 0;
+    }
+
     while (1) {
-        // procura '\n'
-        for (size_t i = 0; i < len; i++) {
-            if (buf[i] == '\n') {
-                buf[i] = '\0';
-                // move resto para carry
-                size_t rest = len - (i + 1);
-                memmove(carry, buf + i + 1, rest);
-                *carry_len = rest;
-                return 1;
+        msg_t m;
+        int rc;
+        if (pending) {
+            rc = msg_decode_text(line, &m);
+            pending = 0;
+        } else if (!msg_recv(&lb, fd, r->proto[slot], &m, &rc)) {
+            // desconectou
+            room_lock(r);
+            leave_locked(r, slot);
+            pthread_mutex_unlock(&r->mut);
+            break;
+        }
+
+        met_add(M_CMD + (rc == MSG_OK ? CMD_KIND[m.op] : rc == MSG_BAD_ARG ? CMD_BAD : CMD_UNKNOWN), 1);
+        cmd_handler_t h = rc == MSG_OK ? CMD_HANDLERS[m.op] : NULL;
+        room_lock(r);
+        int quit = 0;
+        if (h) quit = h(r, slot, &m);
+        else send_op(r, slot, OP_ERR, rc == MSG_BAD_ARG ? ERR_BAD_CMD : ERR_UNKNOWN_CMD);
+        pthread_mutex_unlock(&r->mut);
+        if (quit) break;
+    }
+    room_release(r);
+    return NULL;
+}
+
+/* ----------------------------- matchmaking ----------------------------- */
+
+// Conexao encerrada pelo cliente enquanto aguardava na fila?
+static int peer_closed(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+/*
+ * Cria uma sala nova para o par, envia o estado inicial e dispara as
+ * threads. fd_o = -1 coloca o bot no assento de O.
+ */
+static void start_room(int fd_x, int fd_o) {
+    room_t *r = (room_t *)calloc(1, sizeof(room_t));
+    if (!r) { close_player(fd_x); if (fd_o != -1) close_player(fd_o); return; }
+    pthread_mutex_init(&r->mut, NULL);
+    r->id = atomic_fetch_add(&next_room_id, 1);
+    r->clients[0] = fd_x; r->clients[1] = fd_o;
+    r->proto[0] = r->proto[1] = PROTO_TEXT;
+    r->count = 2;
+    r->current = 0; // X começa
+    r->started = 1;
+    r->bot_slot = fd_o == -1 ? 1 : -1;
+    r->refs = fd_o == -1 ? 2 : 3;   // threads de cliente + temporizador
+    r->deadline = now_ms() + turn_ms;
+    r->timer.fire = room_timer_fire;
+    room_register(r);
+    timer_arm(&r->timer, r->deadline);
+    met_add(M_ROOMS, 1);
+    met_add(M_ROOMS_ACTIVE, 1);
+    if (r->bot_slot != -1) met_add(M_ROOMS_BOT, 1);
+    journal_log(r->id, JR_START, r->bot_slot != -1, 0);
+
+    room_lock(r);
+    for (int slot = 0; slot < 2; slot++)
+        if (slot != r->bot_slot) send_state_locked(r, slot);
+    pthread_mutex_unlock(&r->mut);
+
+    // depois do primeiro pthread_create a sala pode ja ter sido liberada
+    // (sala com bot e jogador que desconecta na hora): nao ler r de novo,
+    // exceto com a referencia do assento cuja thread nao foi criada
+    int bot = r->bot_slot;
+    for (int slot = 0; slot < 2; slot++) {
+        if (slot == bot) continue;
+        client_arg_t *arg = (client_arg_t *)malloc(sizeof(client_arg_t));
+        pthread_t th;
+        if (arg) {
+            arg->room = r;
+            arg->slot = slot;
+        }
+        if (!arg || pthread_create(&th, NULL, client_thread, arg) != 0) {
+            // sem memoria ou sem threads (EAGAIN): o assento sai como num abandono
+            free(arg);
+            room_lock(r);
+            leave_locked(r, slot);
+            pthread_mutex_unlock(&r->mut);
+            room_release(r);
+            continue;
+        }
+        pthread_detach(th);
+    }
+}
+
+static void *matchmaker_thread(void *arg) {
+    (void)arg;
+    waiting_t *batch[MATCH_BATCH];
+    waiting_t *carry = NULL;         // conexao sem par da rodada anterior
+    uint64_t pairs = 0, bots = 0;
+    double wait_sum = 0, wait_max = 0;
+    struct timespec last_report;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+
+    // quem sobra sem par ganha um bot (-b) ou e desconectado por ociosidade
+    long carry_ms = bot_wait_ms > 0 ? bot_wait_ms : idle_ms;
+    uint64_t idle_drops = 0;
+
+    while (1) {
+        // acorda no maximo a cada 1 s, ou quando vencer a espera de quem sobrou
+        long wait_ms = 1000;
+        if (carry) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long left = carry_ms - (long)elapsed_ms(&carry->since, &now);
+            if (left < wait_ms) wait_ms = left > 0 ? left : 0;
+        }
+        struct timespec dl;
+        clock_gettime(CLOCK_REALTIME, &dl);
+        dl.tv_sec += wait_ms / 1000;
+        dl.tv_nsec += (wait_ms % 1000) * 1000000L;
+        if (dl.tv_nsec >= 1000000000L) { dl.tv_sec++; dl.tv_nsec -= 1000000000L; }
+        if (sem_timedwait(&match_ready, &dl) == 0) {
+            size_t n = 0;
+            if (carry) { batch[n++] = carry; carry = NULL; }
+            void *v;
+            int popped = 0;
+            while (n < MATCH_BATCH && mpmc_pop(&match_q, &v) == 0) {
+                batch[n++] = (waiting_t *)v;
+                if (popped++) sem_trywait(&match_ready);   // ja consumimos um post
+            }
+
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            waiting_t *pend = NULL;
+            for (size_t i = 0; i < n; i++) {
+                waiting_t *w = batch[i];
+                if (peer_closed(w->fd)) { close_player(w->fd); free(w); continue; }
+                if (!pend) { pend = w; continue; }
+                double wa = elapsed_ms(&pend->since, &now), wb = elapsed_ms(&w->since, &now);
+                wait_sum += wa + wb;
+                if (wa > wait_max) wait_max = wa;
+                if (wb > wait_max) wait_max = wb;
+                pairs++;
+                start_room(pend->fd, w->fd);
+                free(pend); free(w);
+                pend = NULL;
             }
+            carry = pend;
         }
-        if (len + 1 >= n) { // linha muito longa
-            buf[n-1] = '\0';
-            *carry_len = 0;
-            return 1;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (carry && elapsed_ms(&carry->since, &now) >= carry_ms) {
+            if (peer_closed(carry->fd)) {
+                close_player(carry->fd);
+            } else if (bot_wait_ms <= 0) {
+                msg_t err = { .op = OP_ERR, .arg = ERR_TIMEOUT }, bye = { .op = OP_BYE };
+                send_msg(carry->fd, PROTO_TEXT, &err);
+                send_msg(carry->fd, PROTO_TEXT, &bye);
+                close_player(carry->fd);
+                idle_drops++;
+            } else {
+                double wa = elapsed_ms(&carry->since, &now);
+                wait_sum += wa;
+                if (wa > wait_max) wait_max = wa;
+                bots++;
+                start_room(carry->fd, -1);
+            }
+            free(carry);
+            carry = NULL;
+        }
+        if ((pairs || bots || idle_drops) && elapsed_ms(&last_report, &now) >= REPORT_SEC * 1e3) {
+            printf("Matchmaking: fila=%zu salas=%llu (com bot %llu) espera media=%.3f ms max=%.3f ms"
+                   " sem par=%llu\n",
+                   mpmc_depth(&match_q) + (carry != NULL), (unsigned long long)(pairs + bots),
+                   (unsigned long long)bots,
+                   pairs || bots ? wait_sum / (double)(2 * pairs + bots) : 0.0, wait_max,
+                   (unsigned long long)idle_drops);
+            fflush(stdout);
+            pairs = 0; bots = 0; idle_drops = 0; wait_sum = 0; wait_max = 0;
+            last_report = now;
         }
-        ssize_t r = recv(fd, buf + len, n - 1 - len, 0);
-        if (r <= 0) return 0; // desconectado/erro
-        len += (size_t)r;
     }
+    return NULL;
 }
 
-static void *client_thread(void *arg) {
-    client_arg_t info = *(client_arg_t *)arg;
-    free(arg);
-    int slot = info.slot;
+/* ----------------------------- espectadores ----------------------------- */
+
+typedef struct spec {
+    int fd;
+    uint32_t room;              // 0 enquanto nao enviou WATCH
+    int linked;                 // presente em spec_tab
+    int closing;                // fecha quando a fila de saida esvaziar
+    int want_out;               // EPOLLOUT registrado
+    struct spec *next, *prev;   // balde em spec_tab
+    struct spec *dirty_next;    // lista de quem recebeu eventos nesta rodada
+    int dirty;
+    int dead;                   // fechado; liberado no fim da rodada do epoll
+    uint64_t since;             // ultimo evento da sala ja contido no retrato do WATCH
+    struct spec *grave_next;
+    tnode_t timer;              // prazo para enviar WATCH
+    msgbuf_t *q[SPEC_QUEUE];    // fila de saida: ponteiros para eventos compartilhados
+    unsigned qhead, qtail;
+    size_t off;                 // bytes ja enviados de q[qhead]
+    linebuf_t lb;
+} spec_t;
+
+// Estado privado da thread de espectadores
+static int spec_epfd = -1;
+static int spec_lfd = -1;
+static spec_t *spec_tab[SPEC_BUCKETS];
+static spec_t *spec_dirty;
+static spec_t *spec_grave;      // fechados nesta rodada, liberados depois
+
+static void msgbuf_release(msgbuf_t *b) {
+    if (--b->refs == 0) free(b);
+}
+
+static void spec_link(spec_t *s) {
+    spec_t **head = &spec_tab[s->room % SPEC_BUCKETS];
+    s->prev = NULL;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+    s->linked = 1;
+}
+
+static void spec_unlink(spec_t *s) {
+    if (!s->linked) return;
+    if (s->prev) s->prev->next = s->next;
+    else spec_tab[s->room % SPEC_BUCKETS] = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->linked = 0;
+}
 
-    // Mensagens iniciais ao cliente
-    pthread_mutex_lock(&gmut);
-    char sym = game.symbols[slot];
-    send_line(game.clients[slot], "ASSIGN %c", sym);
-    send_line(game.clients[slot], "WAITING %d/2", game.count);
-    if (game.started) {
-        char b[16]; board_to_str(b, sizeof(b));
-        send_line(game.clients[slot], "START");
-        send_line(game.clients[slot], "BOARD %s", b);
-        send_line(game.clients[slot], "TURN %c", game.symbols[game.current]);
+// Enfileira um evento ja codificado; retorna -1 se a fila do espectador encheu.
+static int spec_enqueue(spec_t *s, msgbuf_t *b) {
+    if (s->qtail - s->qhead == SPEC_QUEUE) return -1;
+    s->q[s->qtail++ & (SPEC_QUEUE - 1)] = b;
+    b->refs++;
+    if (!s->dirty) { s->dirty = 1; s->dirty_next = spec_dirty; spec_dirty = s; }
+    return 0;
+}
+
+// Mensagem so para este espectador (estado inicial, erros)
+static void spec_send_msg(spec_t *s, const msg_t *m) {
+    if (m->op == OP_ERR && m->arg < ERR_COUNT) met_add(M_ERR + m->arg, 1);
+    msgbuf_t *b = (msgbuf_t *)malloc(sizeof(msgbuf_t));
+    if (!b) return;
+    b->refs = 0;
+    b->room = s->room;
+    b->seq = 0;
+    b->op = m->op;
+    b->len = (uint16_t)msg_encode_text(m, b->data);
+    if (spec_enqueue(s, b) < 0) free(b);
+}
+
+static void room_unwatch(uint32_t id) {
+    unsigned b = id % ROOM_BUCKETS;
+    pthread_mutex_lock(&room_tab[b].mut);
+    for (room_t *r = room_tab[b].head; r; r = r->next) {
+        if (r->id == id) { atomic_fetch_sub(&r->watchers, 1); break; }
+    }
+    pthread_mutex_unlock(&room_tab[b].mut);
+}
+
+/*
+ * Fecha o espectador. A memoria so e liberada no fim da rodada do epoll,
+ * porque o mesmo ponteiro pode ainda aparecer nos eventos ja retornados.
+ */
+static void spec_close(spec_t *s) {
+    if (s->dead) return;
+    if (s->linked) {
+        spec_unlink(s);
+        room_unwatch(s->room);
     }
-    pthread_mutex_unlock(&gmut);
+    while (s->qhead != s->qtail) msgbuf_release(s->q[s->qhead++ & (SPEC_QUEUE - 1)]);
+    timer_cancel(&s->timer);
+    close(s->fd);   // remove do epoll
+    met_add(M_SPECTATORS, -1);
+    s->dead = 1;
+    s->grave_next = spec_grave;
+    spec_grave = s;
+}
 
-    char line[MAX_FLOW_SIZE];
-    char carry[MAX_FLOW_SIZE]; size_t carry_len = 0;
+// Envia o que der da fila de saida. Retorna -1 se o espectador foi fechado.
+static int spec_flush(spec_t *s) {
+    while (s->qhead != s->qtail) {
+        struct iovec iov[64];
+        int n = 0;
+        for (unsigned i = s->qhead; i != s->qtail && n < 64; i++, n++) {
+            msgbuf_t *b = s->q[i & (SPEC_QUEUE - 1)];
+            size_t skip = n == 0 ? s->off : 0;
+            iov[n].iov_base = b->data + skip;
+            iov[n].iov_len = b->len - skip;
+        }
+        ssize_t w = writev(s->fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            spec_close(s);
+            return -1;
+        }
+        size_t left = (size_t)w;
+        while (left && s->qhead != s->qtail) {
+            msgbuf_t *b = s->q[s->qhead & (SPEC_QUEUE - 1)];
+            size_t rem = b->len - s->off;
+            if (left < rem) { s->off += left; break; }
+            left -= rem;
+            s->off = 0;
+            s->qhead++;
+            msgbuf_release(b);
+        }
+    }
 
-    while (1) {
-        int ok = recv_line(game.clients[slot], line, sizeof(line), carry, &carry_len);
-        if (!ok) {
-            // desconectou
-            pthread_mutex_lock(&gmut);
-            int fd = game.clients[slot];
-            game.clients[slot] = -1;
-            if (!game.game_over) {
-                game.game_over = 1;
-                bcast("OPP_LEFT");
-                bcast("BYE");
+    int pending = s->qhead != s->qtail;
+    if (!pending && s->closing) { spec_close(s); return -1; }
+    if (pending != s->want_out) {
+        struct epoll_event ev = { .events = EPOLLIN | (pending ? EPOLLOUT : 0), .data.ptr = s };
+        epoll_ctl(spec_epfd, EPOLL_CTL_MOD, s->fd, &ev);
+        s->want_out = pending;
+    }
+    return 0;
+}
+
+static void spec_flush_dirty(void) {
+    while (spec_dirty) {
+        spec_t *s = spec_dirty;
+        spec_dirty = s->dirty_next;
+        s->dirty = 0;
+        if (!s->dead) spec_flush(s);
+    }
+}
+
+// Inscreve o espectador na sala e enfileira o estado atual.
+static void spec_watch(spec_t *s, uint32_t id) {
+    int found = 0, over = 0, cur = 0;
+    uint64_t since = 0;
+    uint16_t marks[2] = { 0, 0 };
+    unsigned b = id % ROOM_BUCKETS;
+    pthread_mutex_lock(&room_tab[b].mut);
+    for (room_t *r = room_tab[b].head; r; r = r->next) {
+        if (r->id != id) continue;
+        // watchers e o retrato do estado sob o mesmo mutex da sala: todo
+        // evento posterior ao retrato sera publicado, e os anteriores que
+        // ainda estao em event_q sao pulados por numero de sequencia
+        room_lock(r);
+        atomic_fetch_add(&r->watchers, 1);
+        since = r->events;
+        marks[0] = r->marks[0]; marks[1] = r->marks[1];
+        cur = r->current;
+        over = r->game_over;
+        pthread_mutex_unlock(&r->mut);
+        found = 1;
+        break;
+    }
+    pthread_mutex_unlock(&room_tab[b].mut);
+
+    s->room = id;
+    s->since = since;
+    timer_cancel(&s->timer);
+    if (!found) {
+        msg_t err = { .op = OP_ERR, .arg = ERR_NO_ROOM }, bye = { .op = OP_BYE };
+        spec_send_msg(s, &err);
+        spec_send_msg(s, &bye);
+        s->closing = 1;
+        return;
+    }
+    spec_link(s);
+
+    msg_t room = { .op = OP_ROOM, .id = id };
+    msg_t start = { .op = OP_START };
+    msg_t board = { .op = OP_BOARD, .marks = { marks[0], marks[1] } };
+    msg_t turn = { .op = OP_TURN, .arg = (uint8_t)BOARD_SYMBOLS[cur] };
+    spec_send_msg(s, &room);
+    spec_send_msg(s, &start);
+    spec_send_msg(s, &board);
+    if (over) {
+        msg_t err = { .op = OP_ERR, .arg = ERR_GAME_OVER }, bye = { .op = OP_BYE };
+        spec_send_msg(s, &err);
+        spec_send_msg(s, &bye);
+        spec_unlink(s);
+        room_unwatch(id);
+        s->closing = 1;
+    } else {
+        spec_send_msg(s, &turn);
+    }
+}
+
+// Repassa um evento publicado a todos os inscritos da sala.
+static void spec_fanout(msgbuf_t *b) {
+    b->refs = 1;    // segura o buffer durante a distribuicao
+    spec_t *s = spec_tab[b->room % SPEC_BUCKETS];
+    while (s) {
+        spec_t *next = s->next;
+        if (s->room == b->room && b->seq > s->since) {
+            if (spec_enqueue(s, b) < 0) {
+                // espectador lento demais: descarta
+                s->closing = 1;
+                spec_unlink(s);
+                room_unwatch(s->room);
+            } else if (b->op == OP_BYE) {
+                // partida encerrada: fecha depois de entregar o BYE
+                s->closing = 1;
+                spec_unlink(s);
             }
-            pthread_mutex_unlock(&gmut);
-            if (fd != -1) close(fd);
+        }
+        s = next;
+    }
+    msgbuf_release(b);
+}
+
+// Espectador que conectou e nao se inscreveu em nenhuma sala a tempo
+static void spec_timer_fire(tnode_t *t) {
+    spec_t *s = (spec_t *)((char *)t - offsetof(spec_t, timer));
+    if (s->dead || s->room) return;
+    msg_t err = { .op = OP_ERR, .arg = ERR_TIMEOUT }, bye = { .op = OP_BYE };
+    spec_send_msg(s, &err);
+    spec_send_msg(s, &bye);
+    s->closing = 1;
+    idle_reaped++;
+}
+
+static void spec_accept(void) {
+    while (1) {
+        int fd = accept4(spec_lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;   // EAGAIN ou erro: tenta no proximo aviso
+        spec_t *s = (spec_t *)calloc(1, sizeof(spec_t));
+        if (!s) { close(fd); continue; }
+        s->fd = fd;
+        met_add(M_SPECTATORS, 1);
+        lb_init(&s->lb);
+        s->timer.fire = spec_timer_fire;
+        timer_arm(&s->timer, now_ms() + idle_ms);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+        epoll_ctl(spec_epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+static void spec_read(spec_t *s) {
+    while (!s->dead) {
+        ssize_t r = lb_fill(&s->lb, s->fd);
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            spec_close(s);
             break;
         }
-        // parse comando
-        if (strncmp(line, "MOVE ", 5) == 0) {
-            int pos;
-            if (safe_parse_int(line + 5, &pos) == 0) {
-                pthread_mutex_lock(&gmut);
-                handle_move_locked(slot, pos);
-                pthread_mutex_unlock(&gmut);
+        const char *line;
+        size_t len;
+        while (!s->dead && lb_next(&s->lb, &line, &len)) {
+            msg_t m;
+            int rc = msg_decode_text(line, &m);
+            if (rc == MSG_OK && m.op == OP_END) { spec_close(s); break; }
+            if (s->room || s->closing) continue;   // ja inscrito: ignora
+            if (rc == MSG_OK && m.op == OP_WATCH) {
+                spec_watch(s, m.id);
             } else {
-                pthread_mutex_lock(&gmut);
-                send_line(game.clients[slot], "ERR Comando invalido");
-                pthread_mutex_unlock(&gmut);
-            }
-        } else if (strcmp(line, "END") == 0) {
-            pthread_mutex_lock(&gmut);
-            int fd = game.clients[slot];
-            game.clients[slot] = -1;
-            if (!game.game_over) {
-                game.game_over = 1;
-                bcast("OPP_LEFT");
-                bcast("BYE");
+                msg_t err = { .op = OP_ERR, .arg = rc == MSG_BAD_ARG ? ERR_BAD_CMD : ERR_UNKNOWN_CMD };
+                spec_send_msg(s, &err);
             }
-            pthread_mutex_unlock(&gmut);
-            if (fd != -1) close(fd);
+        }
+        if (r < 0) break;
+    }
+    spec_flush_dirty();
+}
+
+static void timer_report(void) {
+    static uint64_t last_ms, last_turn, last_idle;
+    uint64_t now = now_ms();
+    if (now - last_ms < REPORT_SEC * 1000) return;
+    last_ms = now;
+    if (turn_timeouts == last_turn && idle_reaped == last_idle) return;
+    pthread_mutex_lock(&timer_mut);
+    size_t armed = timers.count;
+    pthread_mutex_unlock(&timer_mut);
+    printf("Prazos: temporizadores=%zu vez esgotada=%llu ociosos desconectados=%llu\n", armed,
+           (unsigned long long)turn_timeouts, (unsigned long long)idle_reaped);
+    fflush(stdout);
+    last_turn = turn_timeouts;
+    last_idle = idle_reaped;
+}
+
+// Laco de eventos dos espectadores: aceita, le WATCH, distribui eventos e
+// faz o tick da roda de temporizadores.
+static void *spectator_thread(void *arg) {
+    (void)arg;
+    struct epoll_event evs[256];
+    while (1) {
+        int n = epoll_wait(spec_epfd, evs, 256, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
             break;
-        } else {
-            pthread_mutex_lock(&gmut);
-            send_line(game.clients[slot], "ERR Comando desconhecido");
-            pthread_mutex_unlock(&gmut);
+        }
+        for (int i = 0; i < n; i++) {
+            void *p = evs[i].data.ptr;
+            if (p == &spec_lfd) {
+                spec_accept();
+            } else if (p == &spec_tfd) {
+                uint64_t cnt;
+                if (read(spec_tfd, &cnt, sizeof(cnt)) < 0) { /* ja drenado */ }
+                pthread_mutex_lock(&timer_mut);
+                tnode_t *due = tw_expire(&timers, now_ms() / TIMER_TICK_MS);
+                pthread_mutex_unlock(&timer_mut);
+                tw_fire_all(due);
+                spec_flush_dirty();
+                timer_report();
+            } else if (p == &spec_efd) {
+                uint64_t cnt;
+                if (read(spec_efd, &cnt, sizeof(cnt)) < 0) { /* ja drenado */ }
+                atomic_store(&spec_wake, 0);
+                void *v;
+                while (mpmc_pop(&event_q, &v) == 0) spec_fanout((msgbuf_t *)v);
+                spec_flush_dirty();
+            } else {
+                spec_t *s = (spec_t *)p;
+                if (s->dead) continue;
+                if (evs[i].events & (EPOLLERR | EPOLLHUP)) { spec_close(s); continue; }
+                if (evs[i].events & EPOLLOUT) {
+                    if (spec_flush(s) < 0) continue;
+                }
+                if (evs[i].events & EPOLLIN) spec_read(s);
+            }
+        }
+        while (spec_grave) {
+            spec_t *s = spec_grave;
+            spec_grave = s->grave_next;
+            free(s);
         }
     }
     return NULL;
 }
 
-int main(int argc, char *argv[]) {
-    // Inicializa estado do jogo
-    memset(&game, 0, sizeof(game));
-    game.clients[0] = game.clients[1] = -1;
-    game.symbols[0] = 'X'; game.symbols[1] = 'O';
-    for (int i = 0; i < 9; i++) game.board[i] = '.';
-    game.count = 0; game.current = 0; game.started = 0; game.game_over = 0;
+/* ------------------------------ aceitacao ------------------------------ */
 
-    int port = DEFAULT_PORT;
-    if (argc == 2) {
-        int p = atoi(argv[1]);
-        if (p > 0 && p <= 65535) port = p;
+static void enqueue_conn(int conn) {
+    // respostas do jogo (e do bot) sao varias mensagens curtas: sem Nagle
+    int one = 1;
+    setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    msg_t wait = { .op = OP_WAITING, .arg = 1 };
+    send_msg(conn, PROTO_TEXT, &wait);
+
+    waiting_t *w = (waiting_t *)malloc(sizeof(waiting_t));
+    if (w) {
+        w->fd = conn;
+        clock_gettime(CLOCK_MONOTONIC, &w->since);
     }
+    if (!w || mpmc_push(&match_q, w) < 0) {
+        msg_t err = { .op = OP_ERR, .arg = ERR_SERVER_FULL }, bye = { .op = OP_BYE };
+        send_msg(conn, PROTO_TEXT, &err);
+        send_msg(conn, PROTO_TEXT, &bye);
+        close(conn);
+        free(w);
+        met_add(M_REFUSED, 1);
+        return;
+    }
+    met_add(M_ACCEPTED, 1);
+    met_add(M_PLAYERS, 1);
+    sem_post(&match_ready);
+}
 
-    int sockId = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockId < 0) { perror("socket"); return 1; }
+static void *acceptor_thread(void *arg) {
+    int lfd = *(int *)arg;
+    while (1) {
+        int conn = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            met_add(M_ACCEPT_ERRORS, 1);
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // sem descritores/memoria: espera um pouco em vez de girar
+                struct timespec ts = { 0, 10 * 1000 * 1000 };
+                nanosleep(&ts, NULL);
+                continue;
+            }
+            // erros de rede da conexao pendente (accept(2)): so ela se perde
+            if (errno == EPROTO || errno == ENETDOWN || errno == ENETUNREACH || errno == EHOSTDOWN ||
+                errno == EHOSTUNREACH || errno == ENONET || errno == ENOPROTOOPT || errno == EOPNOTSUPP ||
+                errno == ETIMEDOUT || errno == EPERM)
+                continue;
+            // qualquer outro erro encerra este aceitador; fechar o socket tira
+            // da porta a parte das conexoes que o kernel ainda mandaria para ele
+            perror("accept");
+            close(lfd);
+            break;
+        }
+        enqueue_conn(conn);
+    }
+    return NULL;
+}
+
+// Socket de escuta com SO_REUSEPORT; *port e atualizada se for 0.
+static int open_listener(int *port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); return -1; }
 
     int yes = 1;
-    setsockopt(sockId, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        close(fd);
+        return -1;
+    }
 
     struct sockaddr_in server;
     memset(&server, 0, sizeof(server));
     server.sin_family = AF_INET;
     server.sin_addr.s_addr = INADDR_ANY;
-    server.sin_port = htons(port);
+    server.sin_port = htons(*port);
 
-    if (bind(sockId, (struct sockaddr *)&server, sizeof(server)) < 0) {
+    if (bind(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
         perror("bind");
-        close(sockId);
-        return 1;
+        close(fd);
+        return -1;
     }
 
     socklen_t slen = sizeof(server);
-    if (getsockname(sockId, (struct sockaddr *)&server, &slen) == 0) {
-        printf("Servidor na porta: %d\n", ntohs(server.sin_port));
+    if (getsockname(fd, (struct sockaddr *)&server, &slen) == 0) {
+        *port = ntohs(server.sin_port);
     }
 
-    if (listen(sockId, QUEUE_LENGTH) < 0) {
+    if (listen(fd, backlog) < 0) {
         perror("listen");
-        close(sockId);
-        return 1;
+        close(fd);
+        return -1;
     }
+    return fd;
+}
 
-    while (1) {
-        struct sockaddr_in client;
-        socklen_t clen = sizeof(client);
-        int conn = accept(sockId, (struct sockaddr *)&client, &clen);
-        if (conn < 0) {
-            if (errno == EINTR) continue;
-            perror("accept");
-            break;
-        }
+int main(int argc, char *argv[]) {
+    // cliente que fecha no meio de um send nao pode derrubar o servidor
+    signal(SIGPIPE, SIG_IGN);
+    board_init_tables();
+    bot_init_tables();
+    if (met_init(MET_DEFS, sizeof(MET_DEFS) / sizeof(MET_DEFS[0])) < 0) { printf("Metricas demais\n"); return 1; }
+    if (mpmc_init(&match_q, MATCH_QUEUE_CAP) < 0) { perror("malloc"); return 1; }
+    sem_init(&match_ready, 0, 0);
+    if (mpmc_init(&event_q, EVENT_QUEUE_CAP) < 0) { perror("malloc"); return 1; }
+    for (int i = 0; i < ROOM_BUCKETS; i++) pthread_mutex_init(&room_tab[i].mut, NULL);
 
-        pthread_mutex_lock(&gmut);
-        if (game.count >= 2 || game.game_over) {
-            send_line(conn, "ERR Sala cheia");
-            send_line(conn, "BYE");
-            close(conn);
-            pthread_mutex_unlock(&gmut);
-            continue;
+    int port = DEFAULT_PORT;
+    int spec_port = 0;
+    int backlog = DEFAULT_BACKLOG;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nacc = ncpu > 0 ? (int)ncpu : 1;
+    if (nacc > MAX_ACCEPTORS) nacc = MAX_ACCEPTORS;
+
+    int opt;
+    const char *journal_path = NULL, *metrics_path = NULL;
+    while ((opt = getopt(argc, argv, "a:l:e:b:j:t:i:m:")) != -1) {
+        switch (opt) {
+        case 'a': nacc = atoi(optarg); break;
+        case 'l': backlog = atoi(optarg); break;
+        case 'e': spec_port = atoi(optarg); break;
+        case 'b': bot_wait_ms = atoi(optarg); break;
+        case 'j': journal_path = optarg; break;
+        case 't': turn_ms = atoi(optarg); break;
+        case 'i': idle_ms = atoi(optarg); break;
+        case 'm': metrics_path = optarg; break;
+        default:
+            printf("Uso: %s [-a aceitadores] [-l backlog] [-e porta_espectadores] "
+                   "[-b espera_bot_ms] [-j diario] [-t prazo_jogada_ms] [-i prazo_ocioso_ms] "
+                   "[-m socket_metricas] [porta]\n", argv[0]);
+            return 1;
         }
-        int slot = (game.clients[0] == -1) ? 0 : 1;
-        game.clients[slot] = conn;
-        game.count++;
-        // Se ambos conectados, inicia
-        start_game_if_ready();
+    }
+    if (nacc < 1) nacc = 1;
+    if (nacc > MAX_ACCEPTORS) nacc = MAX_ACCEPTORS;
+    if (backlog < 1) backlog = DEFAULT_BACKLOG;
+    if (turn_ms < TIMER_TICK_MS) turn_ms = DEFAULT_TURN_MS;
+    if (idle_ms < TIMER_TICK_MS) idle_ms = DEFAULT_IDLE_MS;
+    if (optind < argc) {
+        int p = atoi(argv[optind]);
+        if (p > 0 && p <= 65535) port = p;
+    }
 
-        client_arg_t *arg = (client_arg_t *)malloc(sizeof(client_arg_t));
-        arg->slot = slot;
-        pthread_t th;
-        pthread_create(&th, NULL, client_thread, arg);
+    static int acc_fd[MAX_ACCEPTORS];
+    for (int i = 0; i < nacc; i++) {
+        acc_fd[i] = open_listener(&port, backlog);
+        if (acc_fd[i] < 0) return 1;
+    }
+    printf("Servidor na porta: %d (%d aceitadores, backlog %d)\n", port, nacc, backlog);
+
+    if (spec_port <= 0 || spec_port > 65535) spec_port = port + 1;
+    spec_lfd = open_listener(&spec_port, backlog);
+    if (spec_lfd < 0) return 1;
+    fcntl(spec_lfd, F_SETFL, fcntl(spec_lfd, F_GETFL) | O_NONBLOCK);
+    spec_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    spec_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (spec_efd < 0 || spec_epfd < 0) { perror("epoll/eventfd"); return 1; }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &spec_lfd };
+    epoll_ctl(spec_epfd, EPOLL_CTL_ADD, spec_lfd, &ev);
+    ev.data.ptr = &spec_efd;
+    epoll_ctl(spec_epfd, EPOLL_CTL_ADD, spec_efd, &ev);
+    printf("Espectadores na porta: %d\n", spec_port);
+
+    tw_init(&timers, now_ms() / TIMER_TICK_MS);
+    spec_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (spec_tfd < 0) { perror("timerfd_create"); return 1; }
+    struct itimerspec tick = {
+        .it_interval = { 0, TIMER_TICK_MS * 1000000L },
+        .it_value = { 0, TIMER_TICK_MS * 1000000L },
+    };
+    timerfd_settime(spec_tfd, 0, &tick, NULL);
+    ev.data.ptr = &spec_tfd;
+    epoll_ctl(spec_epfd, EPOLL_CTL_ADD, spec_tfd, &ev);
+    printf("Prazos: jogada %d ms, ocioso %d ms\n", turn_ms, idle_ms);
+
+    if (metrics_path) {
+        if (met_serve(metrics_path) < 0) return 1;
+        printf("Metricas: %s\n", metrics_path);
+    }
+
+    pthread_t th;
+    if (journal_path) {
+        if (journal_open(journal_path) < 0) return 1;
+        pthread_create(&th, NULL, journal_thread, NULL);
+        pthread_detach(th);
+        printf("Diario: %s\n", journal_path);
+    }
+    pthread_create(&th, NULL, spectator_thread, NULL);
+    pthread_detach(th);
+    pthread_create(&th, NULL, matchmaker_thread, NULL);
+    pthread_detach(th);
+    for (int i = 0; i < nacc; i++) {
+        pthread_create(&th, NULL, acceptor_thread, &acc_fd[i]);
         pthread_detach(th);
-        pthread_mutex_unlock(&gmut);
     }
 
-    close(sockId);
+    // Relatorio periodico de aceitacao
+    uint64_t last_acc = 0, last_ref = 0, last_err = 0;
+    while (1) {
+        sleep(REPORT_SEC);
+        uint64_t v[MET_SLOTS];
+        met_snapshot(v);
+        uint64_t a = v[M_ACCEPTED], r = v[M_REFUSED], e = v[M_ACCEPT_ERRORS];
+        if (a == last_acc && r == last_ref && e == last_err) continue;
+        printf("Conexoes: aceitas=%llu (%.1f/s) recusadas=%llu erros de accept=%llu\n",
+               (unsigned long long)a, (double)(a - last_acc) / REPORT_SEC,
+               (unsigned long long)r, (unsigned long long)e);
+        fflush(stdout);
+        last_acc = a; last_ref = r; last_err = e;
+    }
     return 0;
 }
-
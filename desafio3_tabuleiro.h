@@ -0,0 +1,69 @@
+/*
+ * desafio3_tabuleiro.h - Tabuleiro do Jogo da Velha em bitboard
+ *
+ * Cada jogador tem uma mascara de 9 bits (bit i = casa i). X usa a
+ * mascara 0 e O a mascara 1. Chamar board_init_tables() uma vez antes
+ * de usar board_render().
+ */
+
+#ifndef DESAFIO3_TABULEIRO_H
+#define DESAFIO3_TABULEIRO_H
+
+#include <stdint.h>
+
+#define BOARD_CELLS 9
+#define BOARD_MASK  0x1FF
+
+static const char BOARD_SYMBOLS[2] = { 'X', 'O' };
+
+// Linhas vencedoras como mascaras de 9 bits
+static const uint16_t WIN_MASKS[8] = {
+    0x007, 0x038, 0x1C0,  // linhas
+    0x049, 0x092, 0x124,  // colunas
+    0x111, 0x054          // diagonais
+};
+
+// cell_lut[m][i] = 0xFF se o bit i de m esta ligado, 0x00 caso contrario.
+// Usada apenas para gerar o texto de BOARD, sem desvios por casa.
+static uint8_t cell_lut[BOARD_MASK + 1][BOARD_CELLS];
+
+static inline void board_init_tables(void) {
+    for (int m = 0; m <= BOARD_MASK; m++)
+        for (int i = 0; i < BOARD_CELLS; i++)
+            cell_lut[m][i] = (m >> i) & 1 ? 0xFF : 0x00;
+}
+
+// Escreve os 9 caracteres ('.', 'X', 'O') e o '\0' em out.
+static inline void board_render(uint16_t x, uint16_t o, char *out) {
+    const uint8_t *lx = cell_lut[x & BOARD_MASK];
+    const uint8_t *lo = cell_lut[o & BOARD_MASK];
+    const char cx = 'X' ^ '.', co = 'O' ^ '.';
+    for (int i = 0; i < BOARD_CELLS; i++)
+        out[i] = (char)('.' ^ (lx[i] & cx) ^ (lo[i] & co));
+    out[BOARD_CELLS] = '\0';
+}
+
+// Converte o texto de BOARD em mascaras. Retorna -1 se malformado.
+static inline int board_parse(const char *s, uint16_t *x, uint16_t *o) {
+    uint16_t mx = 0, mo = 0;
+    for (int i = 0; i < BOARD_CELLS; i++) {
+        if (s[i] == 'X') mx |= (uint16_t)(1u << i);
+        else if (s[i] == 'O') mo |= (uint16_t)(1u << i);
+        else if (s[i] != '.') return -1;
+    }
+    *x = mx; *o = mo;
+    return 0;
+}
+
+static inline int board_wins(uint16_t m) {
+    for (int i = 0; i < 8; i++) {
+        if ((m & WIN_MASKS[i]) == WIN_MASKS[i]) return 1;
+    }
+    return 0;
+}
+
+static inline int board_full(uint16_t x, uint16_t o) {
+    return __builtin_popcount(x | o) == BOARD_CELLS;
+}
+
+#endif
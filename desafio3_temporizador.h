@@ -0,0 +1,100 @@
+/*
+ * desafio3_temporizador.h - Roda de temporizadores (hashed timing wheel)
+ *
+ * O tempo e contado em ticks. Cada temporizador fica na lista circular
+ * da posicao (vencimento % TW_SLOTS); inserir e cancelar sao O(1) e cada
+ * tick so percorre uma posicao. Vencimentos alem de uma volta da roda
+ * ficam na mesma lista e sao pulados ate a volta certa.
+ *
+ * O no fica embutido na estrutura dona (sala, conexao); fire recebe o
+ * no e recupera a estrutura. Sem travas: quem compartilha a roda entre
+ * threads protege as chamadas.
+ */
+
+#ifndef DESAFIO3_TEMPORIZADOR_H
+#define DESAFIO3_TEMPORIZADOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_SLOTS 1024   // potencia de 2
+
+typedef struct tnode {
+    struct tnode *next, *prev;      // NULL quando fora da roda
+    uint64_t expires;               // tick de vencimento
+    void (*fire)(struct tnode *t);
+} tnode_t;
+
+typedef struct {
+    tnode_t slots[TW_SLOTS];        // sentinelas das listas
+    uint64_t now;                   // ultimo tick processado
+    size_t count;                   // temporizadores armados
+} twheel_t;
+
+static inline void tw_init(twheel_t *w, uint64_t now) {
+    for (int i = 0; i < TW_SLOTS; i++) w->slots[i].next = w->slots[i].prev = &w->slots[i];
+    w->now = now;
+    w->count = 0;
+}
+
+static inline int tw_pending(const tnode_t *t) {
+    return t->next != NULL;
+}
+
+// Arma t para o tick expires (no passado: vence no proximo tw_expire).
+static inline void tw_add(twheel_t *w, tnode_t *t, uint64_t expires) {
+    if (expires <= w->now) expires = w->now + 1;
+    tnode_t *head = &w->slots[expires & (TW_SLOTS - 1)];
+    t->expires = expires;
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+    w->count++;
+}
+
+static inline void tw_del(twheel_t *w, tnode_t *t) {
+    if (!t->next) return;
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    w->count--;
+}
+
+/*
+ * Avanca ate o tick now e devolve os vencidos numa lista simples
+ * (encadeada por prev), ja fora da roda. O chamador dispara cada um
+ * depois de soltar a trava, e fire pode rearmar o proprio no.
+ */
+static inline tnode_t *tw_expire(twheel_t *w, uint64_t now) {
+    tnode_t *out = NULL;
+    // mais de uma volta atrasado: basta uma passada por todas as posicoes
+    uint64_t from = now - w->now > TW_SLOTS ? now - TW_SLOTS : w->now;
+    for (uint64_t tick = from + 1; tick <= now; tick++) {
+        tnode_t *head = &w->slots[tick & (TW_SLOTS - 1)];
+        tnode_t *t = head->next;
+        while (t != head) {
+            tnode_t *next = t->next;
+            if (t->expires <= now) {
+                tw_del(w, t);
+                t->prev = out;
+                out = t;
+            }
+            t = next;
+        }
+    }
+    if (now > w->now) w->now = now;
+    return out;
+}
+
+// Dispara a lista devolvida por tw_expire.
+static inline void tw_fire_all(tnode_t *t) {
+    while (t) {
+        tnode_t *next = t->prev;
+        t->prev = NULL;
+        t->fire(t);
+        t = next;
+    }
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * metricas.h - Contadores e medidores por thread, exportados por socket Unix
+ *
+ * Cada thread escreve so no proprio bloco de valores (alinhado em linha
+ * de cache), entao registrar e um load + add + store sem atomico com
+ * lock e sem compartilhar linha com outra thread. A leitura soma os
+ * blocos de todas as threads. Quando uma thread termina, seus valores
+ * sao somados a um acumulador e o bloco volta para reuso.
+ *
+ * O programa descreve suas metricas numa tabela met_def_t, na mesma
+ * ordem do seu enum de indices; familias com rotulo ocupam n indices
+ * consecutivos. met_serve() atende cada conexao no socket com um retrato
+ * no formato texto do Prometheus (com cabecalho HTTP se o pedido for
+ * um GET), por exemplo:
+ *
+ *     curl --unix-socket /tmp/velha.sock http://localhost/metrics
+ *     nc -U /tmp/velha.sock
+ *
+ * Medidores (MET_GAUGE) tambem sao somas por thread: uma thread pode
+ * somar +1 e outra -1. met_set so vale para serie escrita por uma unica
+ * thread.
+ *
+ * Compilar com -lpthread.
+ */
+
+#ifndef METRICAS_H
+#define METRICAS_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MET_SLOTS 64    // maximo de series por programa (8 linhas de cache)
+
+enum { MET_COUNTER, MET_GAUGE };
+
+typedef struct {
+    const char *name;
+    const char *help;
+    int type;                   // MET_COUNTER ou MET_GAUGE
+    const char *label;          // NULL: serie unica
+    const char *const *values;  // valores do rotulo, um por serie
+    int n;                      // series da familia (0 ou 1 sem rotulo)
+    double scale;               // fator na exportacao (ex.: ns -> s); 0 = 1
+} met_def_t;
+
+typedef struct met_block {
+    _Alignas(64) _Atomic uint64_t v[MET_SLOTS];
+    struct met_block *next;     // lista de ativos ou livres
+} met_block_t;
+
+static const met_def_t *met_defs;
+static int met_ndefs;
+static int met_nslots;
+static pthread_mutex_t met_mut = PTHREAD_MUTEX_INITIALIZER;
+static met_block_t *met_live, *met_free;
+static uint64_t met_retired[MET_SLOTS];     // valores de threads ja encerradas
+static pthread_key_t met_key;
+static __thread met_block_t *met_tls;
+
+// Thread encerrada: guarda os valores e recicla o bloco
+static void met_detach(void *p) {
+    met_block_t *b = (met_block_t *)p;
+    pthread_mutex_lock(&met_mut);
+    for (met_block_t **pp = &met_live; *pp; pp = &(*pp)->next) {
+        if (*pp == b) { *pp = b->next; break; }
+    }
+    for (int i = 0; i < met_nslots; i++) {
+        met_retired[i] += atomic_load_explicit(&b->v[i], memory_order_relaxed);
+        atomic_store_explicit(&b->v[i], 0, memory_order_relaxed);
+    }
+    b->next = met_free;
+    met_free = b;
+    pthread_mutex_unlock(&met_mut);
+}
+
+static met_block_t *met_attach(void) {
+    pthread_mutex_lock(&met_mut);
+    met_block_t *b = met_free;
+    if (b) {
+        met_free = b->next;
+    } else if (posix_memalign((void **)&b, 64, sizeof(met_block_t)) == 0) {
+        memset(b, 0, sizeof(*b));
+    } else {
+        b = NULL;
+    }
+    if (b) {
+        b->next = met_live;
+        met_live = b;
+    }
+    pthread_mutex_unlock(&met_mut);
+    if (!b) {
+        // sem memoria: a thread descarta o que registrar
+        static met_block_t sink;
+        return &sink;
+    }
+    pthread_setspecific(met_key, b);
+    met_tls = b;
+    return b;
+}
+
+// Retorna -1 se as series nao couberem em MET_SLOTS.
+static inline int met_init(const met_def_t *defs, int ndefs) {
+    int n = 0;
+    for (int i = 0; i < ndefs; i++) n += defs[i].n > 1 ? defs[i].n : 1;
+    if (n > MET_SLOTS) return -1;
+    met_defs = defs;
+    met_ndefs = ndefs;
+    met_nslots = n;
+    return pthread_key_create(&met_key, met_detach) == 0 ? 0 : -1;
+}
+
+static inline void met_add(int id, int64_t n) {
+    met_block_t *b = met_tls ? met_tls : met_attach();
+    uint64_t v = atomic_load_explicit(&b->v[id], memory_order_relaxed);
+    atomic_store_explicit(&b->v[id], v + (uint64_t)n, memory_order_relaxed);
+}
+
+static inline void met_set(int id, int64_t n) {
+    met_block_t *b = met_tls ? met_tls : met_attach();
+    atomic_store_explicit(&b->v[id], (uint64_t)n, memory_order_relaxed);
+}
+
+// Soma de todas as threads em out[met_nslots]
+static inline void met_snapshot(uint64_t *out) {
+    pthread_mutex_lock(&met_mut);
+    memcpy(out, met_retired, sizeof(uint64_t) * (size_t)met_nslots);
+    for (met_block_t *b = met_live; b; b = b->next)
+        for (int i = 0; i < met_nslots; i++)
+            out[i] += atomic_load_explicit(&b->v[i], memory_order_relaxed);
+    pthread_mutex_unlock(&met_mut);
+}
+
+static inline uint64_t met_value(int id) {
+    uint64_t out[MET_SLOTS];
+    met_snapshot(out);
+    return out[id];
+}
+
+static void met_write_value(FILE *f, const met_def_t *d, uint64_t v) {
+    if (d->scale != 0) fprintf(f, " %.9g\n", (double)(int64_t)v * d->scale);
+    else if (d->type == MET_GAUGE) fprintf(f, " %lld\n", (long long)(int64_t)v);
+    else fprintf(f, " %llu\n", (unsigned long long)v);
+}
+
+// Formato texto do Prometheus (versao 0.0.4)
+static void met_write(FILE *f) {
+    uint64_t v[MET_SLOTS];
+    met_snapshot(v);
+    int id = 0;
+    for (int i = 0; i < met_ndefs; i++) {
+        const met_def_t *d = &met_defs[i];
+        fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", d->name, d->help, d->name,
+                d->type == MET_GAUGE ? "gauge" : "counter");
+        if (!d->label) {
+            fputs(d->name, f);
+            met_write_value(f, d, v[id++]);
+            continue;
+        }
+        for (int j = 0; j < d->n; j++) {
+            fprintf(f, "%s{%s=\"", d->name, d->label);
+            for (const char *c = d->values[j]; *c; c++) {
+                if (*c == '"' || *c == '\\') fputc('\\', f);
+                fputc(*c, f);
+            }
+            fputs("\"}", f);
+            met_write_value(f, d, v[id++]);
+        }
+    }
+}
+
+static void *met_thread(void *arg) {
+    int lfd = (int)(intptr_t)arg;
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // sem descritores/memoria: espera um pouco em vez de girar
+                struct timespec ts = { 0, 10 * 1000 * 1000 };
+                nanosleep(&ts, NULL);
+            }
+            continue;
+        }
+        // curl manda um GET; nc nao manda nada: espera pouco pelo pedido
+        char req[512];
+        ssize_t n = 0;
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        if (poll(&p, 1, 100) > 0) n = recv(fd, req, sizeof(req), 0);
+        FILE *f = fdopen(fd, "w");
+        if (!f) { close(fd); continue; }
+        if (n >= 4 && memcmp(req, "GET ", 4) == 0)
+            fputs("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                  "Connection: close\r\n\r\n", f);
+        met_write(f);
+        fclose(f);
+    }
+    return NULL;
+}
+
+// Abre o socket Unix e dispara a thread que atende os retratos.
+static inline int met_serve(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) { fprintf(stderr, "Caminho longo demais: %s\n", path); return -1; }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    // leitor que fecha no meio do retrato nao pode derrubar o programa
+    signal(SIGPIPE, SIG_IGN);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    pthread_t th;
+    if (pthread_create(&th, NULL, met_thread, (void *)(intptr_t)fd) != 0) { close(fd); return -1; }
+    pthread_detach(th);
+    return 0;
+}
+
+#endif